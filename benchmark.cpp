@@ -0,0 +1,592 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <vector>
+
+#include <sched.h>
+
+#include "getopt.hpp"
+#include "lanes.hpp"
+#include "revision.hpp"
+#include "perf.hpp"
+#include "position.hpp"
+#include "statistics.hpp"
+
+// Benchmark the solver directly (no pipes or output parsing like the
+// tester). Every position of every file is solved repetitions times per
+// method with a cleared transposition table and the answers are checked.
+// Results go out as JSON with means, standard deviations and 95%
+// confidence intervals, both per position and for whole files. With -l
+// the file totals are also appended to a ledger, -D compares two commits
+// in it
+
+namespace {
+
+char const* const METHOD_NAMES[] = { "strong", "weak", "weak2", "lanes" };
+// Strong scores from LaneSolver, a whole file at a time
+int const LANES_METHOD = 3;
+
+struct Stats {
+    double mean   = 0;
+    double stddev = 0;
+    double ci_low = 0, ci_high = 0;
+};
+
+// Two sided 95% quantile of the t distribution for df degrees of freedom
+double t_quantile(size_t df) {
+    static double const T[] = {
+        0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262,
+        2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093,
+        2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045,
+        2.042,
+    };
+    if (df < sizeof(T)/sizeof(T[0])) return T[df];
+    return 1.960;
+}
+
+Stats statistics(std::vector<double> const& samples) {
+    Stats stats;
+    size_t n = samples.size();
+    if (n == 0) return stats;
+    for (auto s: samples) stats.mean += s;
+    stats.mean /= n;
+    if (n > 1) {
+        double sum = 0;
+        for (auto s: samples) sum += (s - stats.mean) * (s - stats.mean);
+        stats.stddev = std::sqrt(sum / (n-1));
+    }
+    double half = n > 1 ? t_quantile(n-1) * stats.stddev / std::sqrt(n) : 0;
+    stats.ci_low  = stats.mean - half;
+    stats.ci_high = stats.mean + half;
+    return stats;
+}
+
+std::string json_string(std::string const& str) {
+    std::string out = "\"";
+    for (char ch: str) {
+        if (ch == '"' || ch == '\\') out += '\\';
+        if (static_cast<unsigned char>(ch) < 0x20) {
+            char buffer[8];
+            snprintf(buffer, sizeof(buffer), "\\u%04x", ch);
+            out += buffer;
+        } else out += ch;
+    }
+    return out + "\"";
+}
+
+std::ostream& operator<<(std::ostream& os, Stats const& stats) {
+    os << "{\"mean\": " << stats.mean << ", \"stddev\": " << stats.stddev
+       << ", \"ci95\": [" << stats.ci_low << ", " << stats.ci_high << "]}";
+    return os;
+}
+
+struct Entry {
+    Position pos;
+    int expected;
+    int score;
+    uint64_t visits, hits, misses;
+    // Summed over the repetitions
+    PerfCounters::Counts counts;
+};
+
+// The available counters divided by divisor
+std::string perf_json(PerfCounters const& counters,
+                      PerfCounters::Counts const& counts, double divisor) {
+    std::ostringstream out;
+    out.precision(10);
+    out << "{";
+    bool first = true;
+    for (int i=0; i<PerfCounters::NR_EVENTS; ++i) {
+        if (!counters.available(i)) continue;
+        out << (first ? "" : ", ") << json_string(PerfCounters::NAMES[i]) << ": " << (divisor > 0 ? counts[i] / divisor : 0);
+        first = false;
+    }
+    out << "}";
+    return out.str();
+}
+
+// The move strings are kept apart so Entry stays trivially copyable
+void read_file(std::string const& file,
+               std::vector<Entry>& entries, std::vector<std::string>& lines) {
+    std::ifstream in;
+    in.exceptions(std::ifstream::badbit);
+    in.open(file);
+    if (!in) throw_errno("Could not open '" + file + "'");
+    entries.clear();
+    lines.clear();
+    std::string line;
+    while (getline(in, line)) {
+        if (line.empty()) continue;
+        std::istringstream fields{line};
+        std::string moves;
+        int expected;
+        if (!(fields >> moves >> expected))
+            throw_logic("Could not parse '" + line + "' in '" + file + "'");
+        entries.emplace_back(Entry{Position{moves}, expected, 0, 0, 0, 0, {}});
+        lines.emplace_back(moves);
+    }
+}
+
+// The ledger is an append only CSV file with a line per file, method and
+// policy of every run, so results can be compared across commits
+char const LEDGER_HEADER[] = "commit,commit_time,run_time,cpu,transposition_entries,repetitions,file,method,policy,positions,visits,kpos_per_s,total_ns";
+size_t const LEDGER_FIELDS = 13;
+
+std::string csv_field(std::string const& str) {
+    if (str.find_first_of(",\"\n") == std::string::npos) return str;
+    std::string out = "\"";
+    for (char ch: str) {
+        if (ch == '"') out += '"';
+        out += ch;
+    }
+    return out + "\"";
+}
+
+std::vector<std::string> csv_fields(std::string const& line) {
+    std::vector<std::string> fields(1);
+    bool quoted = false;
+    for (size_t i=0; i<line.size(); ++i) {
+        char ch = line[i];
+        if (quoted) {
+            if (ch != '"') fields.back() += ch;
+            else if (i+1 < line.size() && line[i+1] == '"') fields.back() += line[++i];
+            else quoted = false;
+        }
+        else if (ch == '"') quoted = true;
+        else if (ch == ',') fields.emplace_back();
+        else fields.back() += ch;
+    }
+    return fields;
+}
+
+// Welch's t test: is the difference in means significant at 95%?
+// Sets t to the test statistic
+bool significant(Stats const& a, size_t na, Stats const& b, size_t nb, double& t) {
+    t = 0;
+    if (na < 2 || nb < 2) return false;
+    double va = a.stddev * a.stddev / na;
+    double vb = b.stddev * b.stddev / nb;
+    if (!(va + vb > 0)) return false;
+    t = (b.mean - a.mean) / std::sqrt(va + vb);
+    double df = (va + vb) * (va + vb) / (va*va/(na-1) + vb*vb/(nb-1));
+    return std::abs(t) > t_quantile(std::max<size_t>(1, df));
+}
+
+// The commit in the ledger starting with revision (the last one if empty)
+std::string ledger_commit(std::vector<std::vector<std::string>> const& rows,
+                          std::string const& revision) {
+    std::string found;
+    for (auto const& row: rows) {
+        auto const& commit = row[0];
+        if (revision.empty()) found = commit;
+        else if (commit.compare(0, revision.size(), revision) == 0) {
+            if (!found.empty() && found != commit)
+                throw_logic("Revision '" + revision + "' is ambiguous in the ledger");
+            found = commit;
+        }
+    }
+    if (found.empty())
+        throw_logic("No revision '" + revision + "' in the ledger");
+    return found;
+}
+
+// Compare the runs of two revisions in the ledger. Runs only match if
+// file, method, policy, cpu and table size are the same, the samples of
+// all matching runs are pooled. Returns the number of significant
+// slowdowns
+size_t compare_ledger(std::string const& ledger, std::string const& old_revision,
+                      std::string const& new_revision, std::ostream& log) {
+    std::ifstream in;
+    in.exceptions(std::ifstream::badbit);
+    in.open(ledger);
+    if (!in) throw_errno("Could not open '" + ledger + "'");
+    std::vector<std::vector<std::string>> rows;
+    std::string line;
+    while (getline(in, line)) {
+        if (line.empty() || line == LEDGER_HEADER) continue;
+        auto fields = csv_fields(line);
+        if (fields.size() != LEDGER_FIELDS)
+            throw_logic("Could not parse '" + line + "' in '" + ledger + "'");
+        rows.emplace_back(std::move(fields));
+    }
+    auto old_commit = ledger_commit(rows, old_revision);
+    auto new_commit = ledger_commit(rows, new_revision);
+    log << "Comparing " << old_commit << " to " << new_commit << std::endl;
+
+    // Keyed by file, method, policy, cpu and table size
+    std::vector<std::string> keys;
+    std::map<std::string, std::vector<double>> old_ns, new_ns;
+    std::map<std::string, std::pair<uint64_t, uint64_t>> visits;
+    for (auto const& row: rows) {
+        bool is_old = row[0] == old_commit;
+        bool is_new = row[0] == new_commit;
+        if (!is_old && !is_new) continue;
+        std::string key = row[6] + " " + row[7] + " " + row[8] + "\n" + row[3] + "\n" + row[4];
+        if (!old_ns.count(key) && !new_ns.count(key)) keys.emplace_back(key);
+        std::vector<double> samples;
+        std::istringstream ns{row[12]};
+        double sample;
+        while (ns >> sample) samples.emplace_back(sample);
+        // Per position visits, so files of different sizes don't mix
+        uint64_t positions = std::max(1ULL, std::stoull(row[9]));
+        uint64_t per_position = std::stoull(row[10]) / positions;
+        if (is_old) {
+            old_ns[key].insert(old_ns[key].end(), samples.begin(), samples.end());
+            visits[key].first = per_position;
+        }
+        if (is_new) {
+            new_ns[key].insert(new_ns[key].end(), samples.begin(), samples.end());
+            visits[key].second = per_position;
+        }
+    }
+
+    size_t nr_slower = 0, nr_compared = 0;
+    for (auto const& key: keys) {
+        auto const& before = old_ns[key];
+        auto const& after  = new_ns[key];
+        std::string name = key.substr(0, key.find('\n'));
+        if (before.empty() || after.empty()) {
+            log << name << ": only in " << (before.empty() ? "new" : "old") << " revision" << std::endl;
+            continue;
+        }
+        ++nr_compared;
+        auto a = statistics(before);
+        auto b = statistics(after);
+        double t;
+        bool differs = significant(a, before.size(), b, after.size(), t);
+        char const* verdict = !differs ? "same" : b.mean > a.mean ? "SLOWER" : "faster";
+        if (differs && b.mean > a.mean) ++nr_slower;
+        char buffer[300];
+        snprintf(buffer, sizeof(buffer), "%s: %.3f ms -> %.3f ms (%+.2f%%, t = %.2f) %s",
+                 name.c_str(), a.mean / 1e6, b.mean / 1e6,
+                 a.mean > 0 ? 100 * (b.mean - a.mean) / a.mean : 0., t, verdict);
+        log << buffer;
+        auto const& v = visits[key];
+        if (v.first != v.second)
+            log << ", visits per position " << v.first << " -> " << v.second;
+        log << std::endl;
+    }
+    log << nr_compared << " compared, " << nr_slower << " significantly slower" << std::endl;
+    return nr_slower;
+}
+
+// Same rules as the tester: the weak methods only need the right sign
+// (and a score that is not better than the real one)
+bool correct(int score, int expected, int method) {
+    if (!method || method == LANES_METHOD) return score == expected;
+    if (expected > 0) return score > 0 && score <= expected;
+    if (expected < 0) return score < 0 && score >= expected;
+    return score == 0;
+}
+
+}
+
+int main([[maybe_unused]] int argc,
+         char const* const* argv) {
+    init_system();
+
+    int transposition_bits = LOG2(TRANSPOSITION_SIZE);
+    uint repetitions = 5;
+    uint warmup = 1;
+    int cpu = -1;
+    bool perf = false;
+    std::vector<std::string> policies{Position::policy()};
+    std::string methods = "012";
+    std::string output = "-";
+    std::string ledger;
+    std::string compare;
+
+    GetOpt options{"Hn:u:c:T:m:o:l:D:P:", argv};
+    long long tmp;
+    while (options.next())
+        switch (options.option()) {
+            case 'n':
+              tmp = atoll(options.arg());
+              if (tmp <= 0) throw(std::range_error("repetitions must be positive"));
+              repetitions = tmp;
+              break;
+            case 'u':
+              tmp = atoll(options.arg());
+              if (tmp < 0) throw(std::range_error("warmup must not be negative"));
+              warmup = tmp;
+              break;
+            case 'c':
+              tmp = atoll(options.arg());
+              if (tmp < 0 || tmp >= CPU_SETSIZE) throw(std::range_error("Invalid cpu"));
+              cpu = tmp;
+              break;
+            case 'T':
+              tmp = atoll(options.arg());
+              if (tmp <= 0 || tmp >= static_cast<int>(sizeof(size_t) * CHAR_BIT))
+                  throw(std::range_error("Invalid transposition_bits"));
+              transposition_bits = tmp;
+              break;
+            case 'm':
+              methods = options.arg();
+              if (methods.empty() ||
+                  methods.find_first_not_of("012l") != std::string::npos)
+                  throw(std::range_error("methods must be made of 0 (strong), 1 (weak), 2 (weak2) and l (lanes)"));
+              break;
+            case 'o': output = options.arg(); break;
+            case 'l': ledger = options.arg(); break;
+            case 'D': compare = options.arg(); break;
+            case 'H': perf = true; break;
+            case 'P': {
+                std::string arg = options.arg();
+                if (arg == "all") {
+                    policies = Position::policies();
+                    break;
+                }
+                policies.clear();
+                std::istringstream names{arg};
+                std::string name;
+                while (getline(names, name, ',')) policies.emplace_back(name);
+                if (policies.empty()) throw(std::range_error("No policies"));
+                break;
+            }
+            default:
+              std::cerr << "usage: " << argv[0] << " [-n repetitions] [-u warmup] [-c cpu] [-T transposition_bits] [-m methods] [-P policy,... | -P all] [-H] [-o json_file] [-l ledger] files...\n       " << argv[0] << " -l ledger -D old_revision[,new_revision]" << std::endl;
+              exit(EXIT_FAILURE);
+        }
+    if (!compare.empty()) {
+        if (ledger.empty()) throw_logic("-D needs a ledger (-l)");
+        auto comma = compare.find(',');
+        std::string new_revision = comma == std::string::npos ? "" : compare.substr(comma+1);
+        return compare_ledger(ledger, compare.substr(0, comma), new_revision, std::cout) ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    std::vector<std::string> files;
+    for (int i = options.ind(); argv[i]; ++i) files.emplace_back(argv[i]);
+    if (files.empty()) throw_logic("No test files");
+
+    if (cpu >= 0) {
+        cpu_set_t cs;
+        CPU_ZERO(&cs);
+        CPU_SET(cpu, &cs);
+        if (sched_setaffinity(0, sizeof(cs), &cs))
+            throw_errno("Could not pin to cpu " + std::to_string(cpu));
+    }
+    Position::init(static_cast<size_t>(1) << transposition_bits);
+    std::unique_ptr<PerfCounters> counters;
+    if (perf) {
+        counters.reset(new PerfCounters);
+        if (!counters->error().empty())
+            std::cerr << "Performance counters: " << (counters->any() ? "partly " : "") << "unavailable (" << counters->error() << ")" << std::endl;
+        if (!counters->any()) counters.reset();
+    }
+
+    std::unique_ptr<std::ofstream> file_out;
+    if (output != "-") {
+        file_out.reset(new std::ofstream);
+        file_out->exceptions(std::ofstream::failbit | std::ofstream::badbit);
+        file_out->open(output);
+    }
+    std::ostream& out = file_out ? *file_out : std::cout;
+    // The human readable summary goes wherever the JSON doesn't
+    std::ostream& log = file_out ? std::cout : std::cerr;
+    out.precision(10);
+
+    out << "{\n";
+    out << "  \"commit\": " << json_string(VCS_COMMIT) << ",\n";
+    out << "  \"commit_time\": " << json_string(VCS_COMMIT_TIME) << ",\n";
+    out << "  \"cpu\": " << json_string(CPUS) << ",\n";
+    out << "  \"pinned_cpu\": " << cpu << ",\n";
+    out << "  \"transposition_entries\": " << Position::transpositions_size() << ",\n";
+    out << "  \"repetitions\": " << repetitions << ",\n";
+    out << "  \"results\": [";
+    std::string run_time;
+    {
+        char buffer[100];
+        time_t now = time(nullptr);
+        strftime(buffer, sizeof(buffer), "%F %T %z", localtime(&now));
+        run_time = buffer;
+    }
+    std::vector<std::string> ledger_lines;
+    bool first_result = true;
+    std::vector<Entry> entries;
+    std::vector<std::string> lines;
+    std::vector<std::vector<double>> times;
+    // Check the names before anything runs
+    auto known = Position::policies();
+    for (auto const& policy: policies)
+        if (std::find(known.begin(), known.end(), policy) == known.end())
+            throw_logic("Unknown search policy '" + policy + "'");
+    // Every method for every policy, except that the lanes method uses no
+    // policy and runs only once (with policy "-")
+    std::vector<std::pair<std::string, int>> runs;
+    for (auto const& policy: policies)
+        for (char m: methods)
+            if (m != 'l') runs.emplace_back(policy, m - '0');
+    if (methods.find('l') != std::string::npos)
+        runs.emplace_back("-", LANES_METHOD);
+    for (auto const& run: runs) {
+        auto const& policy = run.first;
+        int method = run.second;
+        if (method != LANES_METHOD) Position::policy(policy);
+        if (method != 1 && method != LANES_METHOD && Position::wdl()) {
+            log << "Skipping the " << METHOD_NAMES[method] << " method for " << policy << ", its win/draw/loss table only does the weak method" << std::endl;
+            continue;
+        }
+        for (auto const& file: files) {
+            read_file(file, entries, lines);
+            if (method == LANES_METHOD &&
+                !std::all_of(entries.begin(), entries.end(),
+                             [](Entry const& entry) { return LaneSolver::fits(entry.pos); })) {
+                log << "Skipping " << file << " for the lanes method, it has positions with more than " << LaneSolver::MAX_PLIES_LEFT << " empty cells" << std::endl;
+                continue;
+            }
+            times.assign(entries.size(), {});
+            std::vector<double> totals;
+            std::vector<Position> positions;
+            std::vector<int> scores;
+            std::vector<uint64_t> lane_visits;
+            if (method == LANES_METHOD)
+                for (auto const& entry: entries) positions.emplace_back(entry.pos);
+            for (uint rep = 0; rep < warmup + repetitions; ++rep) {
+                if (rep == warmup) Statistics::reset();
+                if (method == LANES_METHOD) {
+                    // Only the whole batch can be timed and counted, so that
+                    // gets spread evenly. No table, so no hits or misses
+                    if (counters) counters->start();
+                    auto start = std::chrono::steady_clock::now();
+                    LaneSolver::solve(positions, scores, lane_visits);
+                    auto end = std::chrono::steady_clock::now();
+                    PerfCounters::Counts counts{};
+                    if (counters) counts = counters->stop();
+                    for (size_t i=0; i<entries.size(); ++i)
+                        if (!correct(scores[i], entries[i].expected, method))
+                            throw_logic("Wrong answer lanes: " + lines[i] + " " + std::to_string(entries[i].expected) + " but got " + std::to_string(scores[i]));
+                    if (rep < warmup) continue;
+                    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+                    for (size_t i=0; i<entries.size(); ++i) {
+                        times[i].emplace_back(ns / entries.size());
+                        entries[i].score  = scores[i];
+                        entries[i].visits = lane_visits[i];
+                        for (int e=0; e<PerfCounters::NR_EVENTS; ++e)
+                            entries[i].counts[e] += counts[e] / entries.size();
+                    }
+                    totals.emplace_back(ns);
+                    continue;
+                }
+                double total = 0;
+                for (size_t i=0; i<entries.size(); ++i) {
+                    auto& entry = entries[i];
+                    Position::reset();
+                    if (counters) counters->start();
+                    auto start = std::chrono::steady_clock::now();
+                    int score = entry.pos.solve(method);
+                    auto end = std::chrono::steady_clock::now();
+                    PerfCounters::Counts counts{};
+                    if (counters) counts = counters->stop();
+                    if (!correct(score, entry.expected, method))
+                        throw_logic("Wrong answer " + std::string{METHOD_NAMES[method]} + ": " + lines[i] + " " + std::to_string(entry.expected) + " but got " + std::to_string(score));
+                    if (rep < warmup) continue;
+                    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+                    times[i].emplace_back(ns);
+                    entry.score  = score;
+                    entry.visits = Position::nr_visits();
+                    entry.hits   = Position::hits();
+                    entry.misses = Position::misses();
+                    for (int e=0; e<PerfCounters::NR_EVENTS; ++e)
+                        entry.counts[e] += counts[e];
+                    total += ns;
+                }
+                if (rep >= warmup) totals.emplace_back(total);
+            }
+
+            uint64_t visits = 0, hits = 0, misses = 0;
+            PerfCounters::Counts counts{};
+            for (auto const& entry: entries) {
+                visits += entry.visits;
+                hits   += entry.hits;
+                misses += entry.misses;
+                for (int e=0; e<PerfCounters::NR_EVENTS; ++e)
+                    counts[e] += entry.counts[e];
+            }
+            auto total = statistics(totals);
+            double precision = total.mean > 0 ? (total.ci_high - total.mean) / total.mean : 0;
+            char buffer[200];
+            if (policies.size() > 1 && method != LANES_METHOD) log << policy << " ";
+            snprintf(buffer, sizeof(buffer), "%s %-6s: avg time: %.3f us, avg visits: %.1f, speed: %.0f Kpos/s, %.0f positions/s, +-%.2f%% (95%%)",
+                     file.c_str(), METHOD_NAMES[method],
+                     total.mean / entries.size() / 1000, 1.0 * visits / entries.size(),
+                     visits * 1e6 / total.mean, entries.size() * 1e9 / total.mean,
+                     100 * precision);
+            log << buffer << std::endl;
+            if (counters)
+                log << "  perf: " << counters->format(counts, visits * repetitions) << std::endl;
+            // Summed over all positions and repetitions
+#if STATISTICS
+            Statistics::print(log);
+#endif /* STATISTICS */
+
+            if (!ledger.empty()) {
+                std::ostringstream samples;
+                samples.precision(10);
+                for (size_t i=0; i<totals.size(); ++i)
+                    samples << (i ? " " : "") << totals[i];
+                std::string fields[] = {
+                    VCS_COMMIT, VCS_COMMIT_TIME, run_time, CPUS,
+                    // Lanes use no table, whatever the last policy left
+                    std::to_string(method == LANES_METHOD ? 0 : Position::transpositions_size()),
+                    std::to_string(repetitions), file, METHOD_NAMES[method],
+                    policy, std::to_string(entries.size()),
+                    std::to_string(visits),
+                    std::to_string(visits * 1e6 / total.mean), samples.str(),
+                };
+                std::string line;
+                for (auto const& field: fields)
+                    line += (line.empty() ? "" : ",") + csv_field(field);
+                ledger_lines.emplace_back(line);
+            }
+
+            out << (first_result ? "\n" : ",\n");
+            first_result = false;
+            out << "    {\"file\": " << json_string(file)
+                << ", \"method\": " << json_string(METHOD_NAMES[method])
+                << ", \"policy\": " << json_string(policy)
+                << ", \"positions\": " << entries.size()
+                << ", \"visits\": " << visits
+                << ", \"hits\": " << hits
+                << ", \"misses\": " << misses
+                << ",\n     \"total_ns\": " << total
+                << ",\n     \"kpos_per_s\": " << visits * 1e6 / total.mean
+                << ",\n     \"positions_per_s\": " << entries.size() * 1e9 / total.mean;
+            if (counters)
+                out << ",\n     \"perf_per_visit\": " << perf_json(*counters, counts, 1. * visits * repetitions);
+            out << ",\n     \"details\": [";
+            for (size_t i=0; i<entries.size(); ++i) {
+                auto const& entry = entries[i];
+                out << (i ? ",\n" : "\n");
+                out << "       {\"position\": " << json_string(lines[i])
+                    << ", \"expected\": " << entry.expected
+                    << ", \"score\": " << entry.score
+                    << ", \"visits\": " << entry.visits
+                    << ", \"hits\": " << entry.hits
+                    << ", \"misses\": " << entry.misses
+                    << ", \"time_ns\": " << statistics(times[i]);
+                if (counters)
+                    out << ", \"perf\": " << perf_json(*counters, entry.counts, repetitions);
+                out << "}";
+            }
+            out << "\n     ]}";
+        }
+    }
+    out << "\n  ]\n}\n";
+    // Only complete runs go into the ledger
+    if (!ledger.empty()) {
+        std::ofstream ledger_out;
+        ledger_out.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+        ledger_out.open(ledger, std::ofstream::app | std::ofstream::ate);
+        if (ledger_out.tellp() == 0) ledger_out << LEDGER_HEADER << "\n";
+        for (auto const& line: ledger_lines) ledger_out << line << "\n";
+        ledger_out.close();
+        log << "Appended " << ledger_lines.size() << " results to " << ledger << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,198 @@
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#include <cstdio>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "book.hpp"
+
+namespace {
+
+struct Shard {
+    Position pos;
+    std::string how;
+    std::string file;
+};
+
+// First line of a shard file. A shard built with other options (or for
+// another board) is refused instead of merged into a wrong book
+std::string shard_header(Shard const& shard, int depth, int method) {
+    return "# shard " + std::to_string(WIDTH) + "x" + std::to_string(HEIGHT) +
+        " depth " + std::to_string(depth) + " method " + std::to_string(method) +
+        " root '" + shard.how + "'";
+}
+
+// Throws if the existing file of shard was not built with header
+void check_header(Shard const& shard, std::istream& in, std::string const& header) {
+    std::string line;
+    if (!getline(in, line) || line.compare(0, 8, "# shard "))
+        throw_logic("Corrupt shard '" + shard.file + "'");
+    if (line != header)
+        throw_logic("Shard '" + shard.file + "' has '" + line + "', expected '" + header + "'. Use another shard directory or remove it");
+}
+
+void check_header(Shard const& shard, std::string const& header) {
+    std::ifstream file{shard.file};
+    if (!file) throw_errno("Could not open '" + shard.file + "'");
+    check_header(shard, file, header);
+}
+
+// Closes a file descriptor however the scope is left
+class FdGuard {
+  public:
+    explicit FdGuard(int fd): fd_{fd} {}
+    ~FdGuard() { if (fd_ >= 0) close(fd_); }
+    FdGuard(FdGuard const&) = delete;
+    FdGuard& operator=(FdGuard const&) = delete;
+    int fd() const { return fd_; }
+
+  private:
+    int const fd_;
+};
+
+bool exists(std::string const& file) {
+    struct stat st;
+    return stat(file.c_str(), &st) == 0;
+}
+
+void collect_shards(Position const& pos, std::string const& how,
+                    std::string const& prefix, int depth,
+                    std::string const& dir, std::vector<Shard>& shards) {
+    if (depth == 0) {
+        shards.emplace_back(Shard{pos, how, dir + "/shard-" + prefix + ".txt"});
+        return;
+    }
+    for (int x=0; x<WIDTH; ++x)
+        if (pos.playable(x)) {
+            char ch = '1' + x;
+            collect_shards(pos.play(x), how + ch, prefix + ch, depth-1, dir, shards);
+        }
+}
+
+// Write content to file such that file either doesn't exist or is complete
+void write_atomic(std::string const& file, std::string const& content) {
+    std::string tmp = file + ".tmp-" + PID;
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) throw_errno("Could not create '" + tmp + "'");
+    char const* ptr = content.data();
+    size_t left = content.size();
+    while (left) {
+        ssize_t wrote = write(fd, ptr, left);
+        if (wrote < 0) {
+            if (errno == EINTR) continue;
+            int err = errno;
+            close(fd);
+            throw_errno(err, "Could not write to '" + tmp + "'");
+        }
+        ptr  += wrote;
+        left -= wrote;
+    }
+    if (fsync(fd)) {
+        int err = errno;
+        close(fd);
+        throw_errno(err, "Could not fsync '" + tmp + "'");
+    }
+    if (close(fd)) throw_errno("Could not close '" + tmp + "'");
+    if (rename(tmp.c_str(), file.c_str()))
+        throw_errno("Could not rename '" + tmp + "' to '" + file + "'");
+    // The rename itself only survives a crash once the directory is synced
+    auto slash = file.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : file.substr(0, slash);
+    FdGuard dir_fd{open(dir.c_str(), O_RDONLY | O_DIRECTORY)};
+    if (dir_fd.fd() < 0) throw_errno("Could not open directory '" + dir + "'");
+    if (fsync(dir_fd.fd())) throw_errno("Could not fsync directory '" + dir + "'");
+}
+
+// Returns false if another process is working on the shard
+bool build_shard(Shard const& shard, int depth, int method, uint nr_threads) {
+    auto header = shard_header(shard, depth, method);
+    if (exists(shard.file)) {
+        check_header(shard, header);
+        return true;
+    }
+    std::string lock_file = shard.file + ".lock";
+    FdGuard lock{open(lock_file.c_str(), O_RDWR | O_CREAT, 0666)};
+    if (lock.fd() < 0) throw_errno("Could not open '" + lock_file + "'");
+    // The lock is released by the kernel if we crash, and when lock
+    // closes the file if generating throws (e.g. Interrupted)
+    if (flock(lock.fd(), LOCK_EX | LOCK_NB)) {
+        int err = errno;
+        if (err == EWOULDBLOCK) return false;
+        throw_errno(err, "Could not lock '" + lock_file + "'");
+    }
+    // Maybe finished by someone else between our check and the lock
+    if (!exists(shard.file)) {
+        std::ostringstream content;
+        content << header << "\n";
+        shard.pos.generate_book(shard.how, depth, method, nr_threads, content);
+        write_atomic(shard.file, content.str());
+    } else
+        check_header(shard, header);
+    unlink(lock_file.c_str());
+    return true;
+}
+
+// Emit the book for pos in generate_book order and return its score.
+// The shards are depth deep below pos and each holds a book_depth deep book
+int merge(Position const& pos, std::string const& how, int depth,
+          int book_depth, int method,
+          std::vector<Shard> const& shards, size_t& next, std::ostream& out) {
+    if (depth == 0) {
+        auto& shard = shards[next++];
+        std::ifstream file;
+        file.exceptions(std::ifstream::badbit);
+        file.open(shard.file);
+        if (!file) throw_errno("Could not open '" + shard.file + "'");
+        check_header(shard, file, shard_header(shard, book_depth, method));
+        std::string line, last;
+        while (getline(file, line)) {
+            out << line << "\n";
+            if (!line.empty()) last = line;
+        }
+        // The shard root comes last
+        auto space = last.rfind(' ');
+        if (space == std::string::npos || last.compare(0, space, shard.how))
+            throw_logic("Corrupt shard '" + shard.file + "'");
+        return std::stoi(last.substr(space+1));
+    }
+    int score = INT_MIN;
+    for (int x=0; x<WIDTH; ++x)
+        if (pos.playable(x)) {
+            char ch = '1' + x;
+            int s = -merge(pos.play(x), how + ch, depth-1, book_depth, method, shards, next, out);
+            if (s > score) score = s;
+        }
+    // Like generate_book a won position still gets its children listed
+    if (pos.won()) score = -pos.score();
+    else if (score == INT_MIN) score = 0;
+    out << pos << how << " " << score << "\n";
+    return score;
+}
+
+}
+
+void generate_sharded_book(Position const& root, std::string const& how,
+                           int depth, int method, uint nr_threads,
+                           std::string const& dir, std::ostream& out) {
+    if (mkdir(dir.c_str(), 0777) && errno != EEXIST)
+        throw_errno("Could not create directory '" + dir + "'");
+    int shard_depth = std::min(depth, SHARD_DEPTH);
+    std::vector<Shard> shards;
+    collect_shards(root, how, "", shard_depth, dir, shards);
+    size_t busy = 0;
+    for (auto const& shard: shards)
+        if (!build_shard(shard, depth - shard_depth, method, nr_threads))
+            ++busy;
+    if (busy) {
+        std::cerr << busy << " of " << shards.size() << " shards are still being built by other processes. Run again to merge" << std::endl;
+        return;
+    }
+    size_t next = 0;
+    merge(root, how, shard_depth, depth - shard_depth, method, shards, next, out);
+    out.flush();
+}
@@ -0,0 +1,21 @@
+#ifndef book_hpp
+# define book_hpp 1
+
+#include <string>
+
+#include "position.hpp"
+
+// Positions this many plies below the root are the roots of the shards
+static int const SHARD_DEPTH = 2;
+
+// Generate the same book as generate_book, but as one file per shard in
+// directory dir. Finished shards are skipped, so an interrupted run can
+// simply be restarted, and several processes can work on the same
+// directory (a shard is claimed by locking its lock file). The process
+// that finds all shards finished merges them to out
+void generate_sharded_book(Position const& root, std::string const& how,
+                           int depth, int method, uint nr_threads,
+                           std::string const& dir,
+                           std::ostream& out = std::cout);
+
+#endif /* book_hpp */
@@ -0,0 +1,95 @@
+#include <fstream>
+#include <sstream>
+
+#include <cstdio>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "checkpoint.hpp"
+
+Checkpoint::Checkpoint(std::string const& file, size_t size, bool resume,
+                       uint interval_ms):
+    file_{file}, interval_{interval_ms} {
+    resumed_ = Position::init_file(file + ".tt", size, resume);
+    if (!resume) unlink(file.c_str());
+    flusher_ = std::thread{&Checkpoint::flusher, this};
+}
+
+Checkpoint::~Checkpoint() {
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        stop_ = true;
+    }
+    stop_condition_.notify_one();
+    flusher_.join();
+    Position::flush_transpositions(0, Position::transpositions_size(), true);
+}
+
+// Write the table out one slice per interval so the cost is spread out
+// and a crash loses at most what changed since the slice was written
+void Checkpoint::flusher() {
+    size_t size = Position::transpositions_size();
+    size_t begin = 0;
+    std::unique_lock<std::mutex> lock{mutex_};
+    while (!stop_condition_.wait_for(lock, interval_, [this]{ return stop_; })) {
+        lock.unlock();
+        Position::flush_transpositions(begin, begin + SLICE, true);
+        begin += SLICE;
+        if (begin >= size) begin = 0;
+        lock.lock();
+    }
+}
+
+bool Checkpoint::load(std::string const& line, int method,
+                      int& min, int& max) const {
+    std::ifstream in{file_};
+    if (!in) return false;
+    std::string key, saved_line;
+    int saved_method;
+    if (!(in >> key) || key != "line") return false;
+    // An empty line is the empty board
+    std::getline(in, saved_line);
+    if (!saved_line.empty() && saved_line[0] == ' ') saved_line.erase(0, 1);
+    if (!(in >> key >> saved_method) || key != "method") return false;
+    if (!(in >> key >> min >> max) || key != "window") return false;
+    return saved_line == line && saved_method == method;
+}
+
+void Checkpoint::save(std::string const& line, int method,
+                      int min, int max) const {
+    std::ostringstream content;
+    content << "line " << line << "\n";
+    content << "method " << method << "\n";
+    content << "window " << min << " " << max << "\n";
+    auto const& text = content.str();
+
+    std::string tmp = file_ + ".tmp-" + PID;
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) throw_errno("Could not create '" + tmp + "'");
+    if (write(fd, text.data(), text.size()) != static_cast<ssize_t>(text.size()) ||
+        fsync(fd)) {
+        int err = errno;
+        close(fd);
+        unlink(tmp.c_str());
+        throw_errno(err, "Could not write '" + tmp + "'");
+    }
+    if (close(fd)) throw_errno("Could not close '" + tmp + "'");
+    if (rename(tmp.c_str(), file_.c_str()))
+        throw_errno("Could not rename '" + tmp + "' to '" + file_ + "'");
+}
+
+int Checkpoint::solve(Position const& pos, std::string const& line,
+                      int method) {
+    int min = INT_MIN;
+    int max = INT_MAX;
+    if (load(line, method, min, max))
+        std::cout << "Resume window [" << min << ", " << max << "]\n";
+    else
+        save(line, method, min, max);
+    int score = pos.solve(method, min, max, [&](int min, int max) {
+        save(line, method, min, max);
+    });
+    save(line, method, score, score);
+    return score;
+}
@@ -0,0 +1,49 @@
+#ifndef checkpoint_hpp
+# define checkpoint_hpp 1
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "position.hpp"
+
+// Checkpointed solves. The transposition table lives in file.tt and a
+// background thread keeps writing it out a slice at a time. After every
+// null window probe the proven [min, max] window is written to file
+// (atomically). A later run that resumes from the same file continues
+// with that window and everything the table already knew
+class Checkpoint {
+  public:
+    // Table slices of this many entries get flushed per interval
+    static size_t const SLICE = static_cast<size_t>(1) << 20;
+
+    // With resume keep an existing checkpoint (and its table size),
+    // otherwise start a new one with a table of size entries
+    Checkpoint(std::string const& file, size_t size, bool resume,
+               uint interval_ms = 100);
+    ~Checkpoint();
+    Checkpoint(Checkpoint const&) = delete;
+    Checkpoint& operator=(Checkpoint const&) = delete;
+
+    // Whether an existing table was kept
+    bool resumed() const { return resumed_; }
+    // Solve pos (given as line) continuing a checkpointed solve of it
+    int solve(Position const& pos, std::string const& line, int method);
+
+  private:
+    bool load(std::string const& line, int method, int& min, int& max) const;
+    void save(std::string const& line, int method, int min, int max) const;
+    void flusher();
+
+    std::string const file_;
+    std::chrono::milliseconds const interval_;
+    bool resumed_;
+    std::mutex mutex_;
+    std::condition_variable stop_condition_;
+    bool stop_ = false;
+    std::thread flusher_;
+};
+
+#endif /* checkpoint_hpp */
@@ -2,67 +2,24 @@
 #include <unordered_set>
 #include <unordered_map>
 #include <fstream>
+#include <memory>
 
 #include <cstdlib>
 
 #include <unistd.h>
 
+#include "getopt.hpp"
 #include "revision.hpp"
 #include "position.hpp"
-
-// Handle commandline options.
-// Simplified getopt for systems that don't have it in their library (Windows..)
-class GetOpt {
-  private:
-    std::string const options;
-    char const* const* argv;
-    int nextchar = 0;
-    int optind = 1;
-    char ch = '?';
-    char const* optarg = nullptr;
-
-  public:
-    int ind() const PURE { return optind; }
-    char const* arg() const PURE { return optarg; }
-    char const* next_arg() { return argv[optind++]; }
-    char option() const PURE { return ch; }
-
-    GetOpt(std::string const options_, char const* const* argv_) :
-        options(options_), argv(argv_) {}
-    char next() {
-        while (1) {
-            if (nextchar == 0) {
-                if (!argv[optind] ||
-                    argv[optind][0] != '-' ||
-                    argv[optind][1] == 0) return ch = 0;
-                if (argv[optind][1] == '-' && argv[optind][2] == 0) {
-                    ++optind;
-                    return ch = 0;
-                }
-                nextchar = 1;
-            }
-            ch = argv[optind][nextchar++];
-            if (ch == 0) {
-                ++optind;
-                nextchar = 0;
-                continue;
-            }
-            auto pos = options.find(ch);
-            if (pos == std::string::npos) ch = '?';
-            else if (options[pos+1] == ':') {
-                if (argv[optind][nextchar]) {
-                    optarg = &argv[optind][nextchar];
-                } else {
-                    optarg = argv[++optind];
-                    if (!optarg) return ch = options[0] == ':' ? ':' : '?';
-                }
-                ++optind;
-                nextchar = 0;
-            }
-            return ch;
-        }
-    }
-};
+#include "engine.hpp"
+#include "book.hpp"
+#include "checkpoint.hpp"
+#include "endgame.hpp"
+#include "enumerate.hpp"
+#include "perf.hpp"
+#include "lanes.hpp"
+#include "statistics.hpp"
+#include "validate.hpp"
 
 using namespace std;
 
@@ -95,6 +52,99 @@ void insert(std::unordered_map<Position, int>& preset, std::string const& book)
     file.close();
 }
 
+// Score every prefix of a game (and optionally every alternative move).
+// Solve from the deepest prefix back to the root so every shallower solve
+// can reuse the transposition table entries of the deeper ones
+void review_game(std::string const& line, int method, bool alternatives) {
+    size_t nr_moves = line.size();
+    std::vector<Position> prefix(nr_moves+1);
+    prefix[0] = Position{""};
+    for (size_t i=0; i<nr_moves; ++i)
+        prefix[i+1] = prefix[i].play(&line[i], 1);
+
+    struct Result {
+        int score;
+        int64_t duration;
+        uint64_t visits;
+        std::array<int, WIDTH> move_score;
+    };
+    std::vector<Result> results(nr_moves+1);
+    uint64_t total_visits = 0;
+    auto game_start = chrono::steady_clock::now();
+    for (size_t i=nr_moves+1; i-- > 0;) {
+        auto& pos = prefix[i];
+        auto& result = results[i];
+        Position::reset(true);
+        pos.set_depth();
+        auto start = chrono::steady_clock::now();
+        result.move_score.fill(INT_MIN);
+        // Alternatives are children, so solve them before their parent
+        if (alternatives && !pos.won())
+            for (int x=0; x<WIDTH; ++x)
+                if (pos.playable(x))
+                    result.move_score[x] = -pos.play(x).solve(method);
+        result.score = pos.solve(method);
+        auto end = chrono::steady_clock::now();
+        result.duration = chrono::duration_cast<chrono::nanoseconds>(end - start).count();
+        result.visits = Position::nr_visits();
+        total_visits += result.visits;
+    }
+    auto game_end = chrono::steady_clock::now();
+    auto game_duration = chrono::duration_cast<chrono::nanoseconds>(game_end - game_start).count();
+
+    for (size_t i=0; i<=nr_moves; ++i) {
+        auto& result = results[i];
+        cout << line.substr(0, i) << " " << result.score << " " << (result.duration+500)/1000 << " " << result.visits << "\n";
+        if (!alternatives) continue;
+        cout << " ";
+        for (auto s: result.move_score)
+            if (s == INT_MIN) cout << " .";
+            else cout << " " << s;
+        cout << "\n";
+    }
+    cout << "Game " << line << ": " << nr_moves+1 << " positions, time " << (game_duration+500)/1000 << ", visits " << total_visits << endl;
+}
+
+// Table size for memory. adjust 0 means at most 8G, negative adjust
+// halves the size that many times
+int auto_transposition_bits(size_t memory, int adjust) {
+    // Leave some room for everything else
+    memory -= memory / 8;
+    int bits = first_bit((memory-1) / sizeof(Transposition::value_type));
+    if (adjust < -bits) throw(range_error("transposition_bits too negative"));
+    bits += adjust;
+    // By default don't take more than 8G)
+    if (adjust == 0) bits = min(bits, static_cast<int>(36 - LOG2(sizeof(Transposition::value_type) * CHAR_BIT)));
+    return bits;
+}
+
+// Count the distinct positions reachable from pos up to ply plies
+void enumerate(Position const& pos, int plies, std::string const& dir,
+               size_t memory, bool keep_keys, uint nr_threads) {
+    Enumerator enumerator{dir, memory, nr_threads};
+    auto game_start = chrono::steady_clock::now();
+    auto start = game_start;
+    auto level = enumerator.start({pos});
+    while (true) {
+        auto end = chrono::steady_clock::now();
+        auto duration = chrono::duration_cast<chrono::nanoseconds>(end - start).count();
+        cout << "ply " << level.ply << ": " << level.positions << " positions, " << level.paths << " paths, " << level.won << " won, time " << (duration+500)/1000 << endl;
+        if (keep_keys) {
+            char name[20];
+            snprintf(name, sizeof(name), "/ply-%02d.keys", level.ply);
+            enumerator.write_keys(level.ply, dir + name);
+        }
+        if (level.ply >= plies || level.positions == level.won) break;
+        start = chrono::steady_clock::now();
+        level = enumerator.expand(level.ply);
+        enumerator.remove(level.ply-1);
+    }
+    enumerator.remove(level.ply);
+    auto end = chrono::steady_clock::now();
+    auto duration = chrono::duration_cast<chrono::nanoseconds>(end - game_start).count();
+    cout << "Enumeration time: " << (duration+500)/1000 << endl;
+}
+
 int main([[maybe_unused]] int argc,
          char const* const* argv) {
     init_system();
@@ -102,15 +152,42 @@ int main([[maybe_unused]] int argc,
 
     uint timeout   = 0;
     int transposition_bits = LOG2(TRANSPOSITION_SIZE);
+    // -T0 and below follow the available memory between input lines
+    bool auto_size  = false;
+    int auto_adjust = 0;
     bool principal = false;
     int  method    = 0;
     bool minimax   = false;
     bool keep      = false;
+    bool wdl       = false;
+    std::string shared_name;
+    std::string checkpoint_file;
+    bool resume    = false;
     int debug      = 0;
     int  generate  = -1;
+    int  review    = 0;
+    int  analysis  = 0;
+    bool engine    = false;
+    int  unique    = 0;
+    std::string shard_dir;
+    int  enumerate_plies = -1;
+    std::string work_dir = ".";
+    bool keep_keys = false;
+    bool perf      = false;
+    [[maybe_unused]] bool json = false;
+    size_t memory  = 256;
+    int  endgame_plies = -1;
+    std::string endgame_file;
+    std::string validate_file;
+    uint nr_threads = 0;
+    // Plain book generation stays single threaded unless asked
+    bool threads_given = false;
+    size_t lane_batch = 0;
+    uint64_t limit  = 0;
+    uint64_t budget = 0;
     std::unordered_set<std::string> books;
 
-    GetOpt options{"mwpt:T:kb:g:d:", argv};
+    GetOpt options{"mwWpraeuKHJx:c:C:v:V:j:l:n:t:T:kb:g:S:E:O:M:R:L:d:", argv};
     while (options.next()) {
         long long tmp;
         switch (options.option()) {
@@ -120,21 +197,59 @@ int main([[maybe_unused]] int argc,
               if (tmp > UINT_MAX) throw(range_error("timeout too large"));
               timeout = tmp;
               break;
+            case 'l':
+              tmp = atoll(options.arg());
+              if (tmp < 0) throw(range_error("time limit must not be negative"));
+              limit = tmp;
+              break;
+            case 'n':
+              tmp = atoll(options.arg());
+              if (tmp < 0) throw(range_error("visit budget must not be negative"));
+              budget = tmp;
+              break;
+            case 'j':
+              tmp = atoll(options.arg());
+              if (tmp < 0) throw(range_error("threads must not be negative"));
+              if (tmp > 1024) throw(range_error("Too many threads"));
+              nr_threads = tmp;
+              threads_given = true;
+              break;
             case 'g':
               tmp = atoll(options.arg());
               if (tmp < -1) throw(range_error("generate must not be negative"));
               if (tmp > AREA) throw(range_error("There aren't that many plies"));
               generate = tmp;
               break;
+            case 'E':
+              tmp = atoll(options.arg());
+              if (tmp < 0) throw(range_error("plies must not be negative"));
+              if (tmp > AREA) throw(range_error("There aren't that many plies"));
+              enumerate_plies = tmp;
+              break;
+            case 'R':
+              tmp = atoll(options.arg());
+              if (tmp < 0) throw(range_error("endgame plies must not be negative"));
+              if (tmp > AREA) throw(range_error("There aren't that many plies"));
+              endgame_plies = tmp;
+              break;
+            case 'V':
+              tmp = atoll(options.arg());
+              if (tmp < 0) throw(range_error("lane batch must not be negative"));
+              lane_batch = tmp;
+              break;
+            case 'M':
+              tmp = atoll(options.arg());
+              if (tmp <= 0) throw(range_error("memory must be positive"));
+              memory = tmp;
+              break;
             case 'T':
               tmp = atoll(options.arg());
               if (tmp <= 0) {
-                  transposition_bits = first_bit((SYSTEM_MEMORY-1) / sizeof(Transposition::value_type));
-                  if (tmp < -transposition_bits)
+                  if (tmp < -static_cast<int>(sizeof(size_t) * CHAR_BIT))
                       throw(range_error("transposition_bits too negative"));
-                  transposition_bits += tmp;
-                  // By default don't take more than 8G)
-                  if (tmp == 0) transposition_bits = min(transposition_bits, static_cast<int>(36 - LOG2(sizeof(Transposition::value_type) * CHAR_BIT)));
+                  auto_size = true;
+                  auto_adjust = tmp;
+                  transposition_bits = auto_transposition_bits(SYSTEM_MEMORY, auto_adjust);
               } else {
                   if (tmp >= static_cast<int>(sizeof(size_t) * CHAR_BIT))
                       throw(range_error("transposition_bits too large"));
@@ -143,12 +258,27 @@ int main([[maybe_unused]] int argc,
               break;
             case 'd': debug = atoll(options.arg()); break;
             case 'b': books.emplace(options.arg()); break;
+            case 'S': shard_dir = options.arg(); break;
+            case 'O': work_dir  = options.arg(); break;
+            case 'K': keep_keys = true; break;
+            case 'H': perf      = true; break;
+            case 'J': json      = true; break;
+            case 'L': endgame_file = options.arg(); break;
+            case 'v': validate_file = options.arg(); break;
+            case 'x': shared_name  = options.arg(); break;
+            case 'c': checkpoint_file = options.arg(); resume = false; break;
+            case 'C': checkpoint_file = options.arg(); resume = true;  break;
             case 'm': minimax   = true; break;
             case 'p': principal = true; break;
             case 'k': keep      = true; break;
             case 'w': ++method;         break;
+            case 'W': wdl       = true; break;
+            case 'r': ++review;         break;
+            case 'a': ++analysis;       break;
+            case 'e': engine    = true; break;
+            case 'u': ++unique;         break;
             default:
-              cerr << "usage: " << argv[0] << " [-t timeout] [-w [-w]] [-p] [-m] [-k] [-T transposition_bits] [-b opening book] [-g depth] [-d debug_level]" << endl;
+              cerr << "usage: " << argv[0] << " [-t timeout] [-l time_limit_ms] [-n visit_budget] [-w [-w] [-W]] [-p] [-m] [-k] [-r [-r]] [-a [-a]] [-e] [-H] [-J] [-j threads] [-V lane_batch] [-T transposition_bits] [-x shared_table] [-c checkpoint | -C checkpoint] [-b opening book] [-v book] [-g depth [-u [-u]] [-S shard_dir]] [-E plies [-O dir] [-M MiB] [-K]] [-R endgame_plies [-O dir]] [-L endgame_file] [-d debug_level]" << endl;
               exit(EXIT_FAILURE);
         }
     }
@@ -160,48 +290,247 @@ int main([[maybe_unused]] int argc,
     cout << "CPU: " << CPUS << "\n";
     cout << "Memory: " << SYSTEM_MEMORY / (1L << 30) << " GiB\n";
     cout << "Swap: " << SYSTEM_SWAP     / (1L << 30) << " GiB\n";
+    if (CGROUP_MEMORY != SIZE_MAX)
+        cout << "Cgroup memory: " << CGROUP_MEMORY / (1L << 20) << " MiB\n";
 
     std::unordered_map<Position, int> preset;
     for (auto const& book: books)
         insert(preset, book);
 
-    Position::init(static_cast<size_t>(1) << transposition_bits);
-    cout << "Transposition table: " << Position::transpositions_bytes() / (1L << 20) << " MiB (" << Position::transpositions_size() / (1L << 20) << " Mi entries)\n";
+    if (wdl && method != 1)
+        throw(logic_error("The win/draw/loss table (-W) needs exactly one -w"));
+    // Lanes solve strongly, without book, endgame database or table
+    if (lane_batch && (minimax || principal || analysis || review || method || engine ||
+                       generate >= 0 || enumerate_plies >= 0 || endgame_plies >= 0 ||
+                       !books.empty() || !validate_file.empty() || !endgame_file.empty() ||
+                       !checkpoint_file.empty() || limit || budget || perf || debug))
+        throw(logic_error("The lane solver (-V) only does plain solves"));
+    std::unique_ptr<Checkpoint> checkpoint;
+    if ((!shared_name.empty() || !checkpoint_file.empty()) && wdl)
+        throw(logic_error("The win/draw/loss table (-W) can't be shared (-x) or checkpointed (-c)"));
+    if (wdl) Position::policy("default-wdl");
+    if (!checkpoint_file.empty()) {
+        if (!shared_name.empty())
+            throw(logic_error("A checkpointed table (-c) can't be shared (-x)"));
+        checkpoint.reset(new Checkpoint{checkpoint_file, static_cast<size_t>(1) << transposition_bits, resume});
+    } else if (!shared_name.empty())
+        Position::init_shared(shared_name, static_cast<size_t>(1) << transposition_bits);
+    else
+        Position::init(static_cast<size_t>(1) << transposition_bits);
+    cout << "Transposition table: " << Position::transpositions_bytes() / (1L << 20) << " MiB (" << Position::transpositions_size() / (1L << 20) << " Mi entries)";
+    if (!shared_name.empty()) cout << " shared as " << shared_name;
+    if (checkpoint) cout << (checkpoint->resumed() ? " resumed from " : " checkpointed to ") << checkpoint_file << ".tt";
+    cout << "\n";
+    if (endgame_plies >= 0) {
+        // All input lines together are the roots of one database
+        std::vector<Position> roots;
+        std::string line;
+        while (getline(cin, line)) {
+            auto space = line.find(' ');
+            if (space != std::string::npos) line.resize(space);
+            roots.emplace_back(line);
+        }
+        auto start = chrono::steady_clock::now();
+        std::string file = work_dir + "/endgame.db";
+        Endgame::build(roots, endgame_plies, work_dir, file, memory << 20, nr_threads);
+        auto end = chrono::steady_clock::now();
+        auto duration = chrono::duration_cast<chrono::nanoseconds>(end - start).count();
+        Endgame endgame{file};
+        cout << "Endgame database " << file << ": " << endgame.size() << " positions with at most " << endgame.plies() << " empty cells, time " << (duration+500)/1000 << endl;
+        return 0;
+    }
+    std::unique_ptr<Endgame> endgame;
+    if (!endgame_file.empty()) {
+        endgame.reset(new Endgame{endgame_file});
+        Position::endgame(endgame.get());
+        cout << "Endgame database: " << endgame->size() << " positions with at most " << endgame->plies() << " empty cells\n";
+    }
     if (keep) Position::reset(false);
+    if (!validate_file.empty()) {
+        Position::reset(false);
+        // Exit status tells if the book was good
+        return validate_book(validate_file, method, nr_threads) ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+    if (engine) {
+        Position::reset(false);
+        Engine{method, limit}.run(cin, cout);
+        return 0;
+    }
+    std::unique_ptr<PerfCounters> counters;
+    PerfCounters::Counts total_counts{};
+    uint64_t total_visits = 0;
+    if (perf) {
+        counters.reset(new PerfCounters);
+        if (!counters->any()) {
+            cout << "Performance counters: unavailable (" << counters->error() << ")\n";
+            counters.reset();
+        } else {
+            cout << "Performance counters:";
+            for (int i=0; i<PerfCounters::NR_EVENTS; ++i)
+                if (counters->available(i)) cout << " " << PerfCounters::NAMES[i];
+            if (!counters->error().empty()) cout << " (" << counters->error() << ")";
+            cout << "\n";
+        }
+    }
+    // Print and add up the counters of the solve that just finished
+    auto report_counters = [&]() {
+        if (!counters) return;
+        auto counts = counters->stop();
+        for (int i=0; i<PerfCounters::NR_EVENTS; ++i)
+            total_counts[i] += counts[i];
+        total_visits += Position::nr_visits();
+        cout << "perf: " << counters->format(counts, Position::nr_visits()) << "\n";
+    };
     if (timeout) alarm(timeout);
     std::string line;
-    while (getline(cin, line)) {
+    // A line the lane solver read ahead but could not take
+    std::string held;
+    bool have_held = false;
+    // An interrupted search leaves valid bounds in the transposition table
+    bool keep_next = false;
+    while (have_held || getline(cin, line)) {
+        if (have_held) {
+            line = held;
+            have_held = false;
+        }
         auto space = line.find(' ');
         if (space != std::string::npos) line.resize(space);
         Position pos{line};
-        Position::reset(keep);
+        if (lane_batch && LaneSolver::fits(pos)) {
+            // Read ahead so the lanes have work. Time per position is the
+            // batch time divided evenly
+            std::vector<Position> batch{pos};
+            std::vector<std::string> moves{line};
+            while (batch.size() < lane_batch && getline(cin, held)) {
+                auto space = held.find(' ');
+                if (space != std::string::npos) held.resize(space);
+                Position p{held};
+                if (!LaneSolver::fits(p)) {
+                    have_held = true;
+                    break;
+                }
+                batch.emplace_back(p);
+                moves.emplace_back(held);
+            }
+            std::vector<int> scores;
+            std::vector<uint64_t> visits;
+            auto start = chrono::steady_clock::now();
+            LaneSolver::solve(batch, scores, visits);
+            auto end = chrono::steady_clock::now();
+            auto duration = chrono::duration_cast<chrono::nanoseconds>(end - start).count() / batch.size();
+            for (size_t i=0; i<batch.size(); ++i)
+                cout << batch[i] << moves[i] << " " << scores[i] << " " << (duration+500)/1000 << " " << visits[i] << "\n";
+            cout.flush();
+            continue;
+        }
+        if (auto_size && !Position::transpositions_shared()) {
+            int bits = auto_transposition_bits(memory_limit(), auto_adjust);
+            if (bits != transposition_bits) {
+                transposition_bits = bits;
+                Position::resize(static_cast<size_t>(1) << bits);
+                cout << "Transposition table resized: " << Position::transpositions_bytes() / (1L << 20) << " MiB (" << Position::transpositions_size() / (1L << 20) << " Mi entries)\n";
+            }
+        }
+        Position::reset(keep || keep_next);
+        Statistics::reset();
+        keep_next = false;
         for (auto const& p: preset) {
-            auto transposition = p.first.transposition_entry();
-            transposition->set(p.first.key(), p.second, 0);
+            p.first.transposition_set(p.second);
+        }
+        if (limit) Position::deadline(Position::Clock::now() + chrono::milliseconds(limit));
+        if (budget) Position::visit_budget(budget);
+        if (enumerate_plies >= 0) {
+            enumerate(pos, enumerate_plies, work_dir, memory << 20, keep_keys, nr_threads);
+            continue;
         }
-        if (generate >= 0) {
-            pos.generate_book(line, generate, method);
+        if (generate >= 0 || review) {
+            try {
+                if (generate >= 0)
+                    if (!shard_dir.empty())
+                        generate_sharded_book(pos, line, generate, method, nr_threads, shard_dir);
+                    else if (unique)
+                        pos.generate_unique_book(line, generate, method, nr_threads, unique > 1);
+                    else if (nr_threads == 1 || !threads_given)
+                        pos.generate_book(line, generate, method);
+                    else
+                        pos.generate_book(line, generate, method, nr_threads);
+                else
+                    review_game(line, method, review > 1);
+            } catch (Interrupted&) {
+                cout << line << " interrupted" << endl;
+                keep_next = true;
+            }
+            Position::no_limits();
             continue;
         }
         cout << pos;
         pos.set_depth();
         auto start = chrono::steady_clock::now();
         int score;
-        if (minimax)
-            score = pos.negamax();
-        else score = pos.solve(method, INT_MIN, debug);
+        std::vector<int> move_scores;
+        std::vector<char> exact;
+        if (counters) counters->start();
+        try {
+            if (analysis) {
+                move_scores = pos.analyze(method, nr_threads, analysis > 1 ? nullptr : &exact);
+                score = INT_MIN;
+                for (auto s: move_scores)
+                    if (s > score) score = s;
+                // No moves. Let solve figure out if that is a loss or a draw
+                if (score == INT_MIN) score = pos.solve(method);
+            } else if (minimax)
+                score = pos.negamax();
+            else if (checkpoint)
+                score = checkpoint->solve(pos, line, method);
+            else score = pos.solve(method, INT_MIN, debug);
+        } catch (Interrupted& interrupted) {
+            Position::no_limits();
+            auto end = chrono::steady_clock::now();
+            auto duration = chrono::duration_cast<chrono::nanoseconds>(end - start).count();
+            cout << "misses: " << Position::misses() << ", hits: " << Position::hits() << "\n";
+            report_counters();
+            // Report the proven score interval and the best move so far
+            cout << line << " [";
+            if (interrupted.min != INT_MIN) cout << interrupted.min;
+            cout << ",";
+            if (interrupted.max != INT_MAX) cout << interrupted.max;
+            cout << "] " << (duration+500)/1000 << " " << Position::nr_visits();
+            if (interrupted.best >= 0) cout << " " << interrupted.best+1;
+            cout << endl;
+            keep_next = true;
+            continue;
+        }
+        Position::no_limits();
         auto end = chrono::steady_clock::now();
         auto duration = chrono::duration_cast<chrono::nanoseconds>(end - start).count();
         cout << "misses: " << Position::misses() << ", hits: " << Position::hits() << "\n";
+        report_counters();
         cout << line << " " << score << " " << (duration+500)/1000 << " " << Position::nr_visits() << endl;
+#if STATISTICS
+        if (json) Statistics::print_json(cout);
+        else Statistics::print(cout);
+#endif /* STATISTICS */
+        if (analysis) {
+            cout << " ";
+            for (size_t x=0; x<move_scores.size(); ++x)
+                if (move_scores[x] == INT_MIN) cout << " .";
+                else cout << (exact.empty() || exact[x] ? " " : " <=") << move_scores[x];
+            cout << endl;
+        }
         if (principal) {
+            auto start = chrono::steady_clock::now();
             auto pv = pos.principal_variation(score, method);
+            auto end = chrono::steady_clock::now();
+            auto duration = chrono::duration_cast<chrono::nanoseconds>(end - start).count();
             auto p = pos;
             for (auto move: pv) {
                 p = p.play(move);
                 std::cout << move+1 << "\n" << p;
             }
+            std::cout << "Principal variation time: " << (duration+500)/1000 << endl;
         }
     }
+    if (counters)
+        cout << "perf total: " << counters->format(total_counts, total_visits) << endl;
     return 0;
 }
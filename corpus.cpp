@@ -0,0 +1,233 @@
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <unordered_set>
+#include <vector>
+
+#include <cstdio>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "getopt.hpp"
+#include "position.hpp"
+
+// Generate benchmark files in the format of the Test files (moves, space,
+// score). Candidates are random playouts to a ply in a chosen range. Each
+// is solved (strong) with a cleared table of a fixed size, so the number
+// of visits needed is reproducible, and put in the bucket for that
+// number. Candidate i only depends on the seed and i, and buckets are
+// filled in candidate order, so the same arguments give the same files
+// however many processes do the solving
+
+namespace {
+
+struct Candidate {
+    std::string moves;
+    Position pos;
+};
+
+// Random playout to ply plies. Fails if the game ends on the way
+bool playout(std::mt19937_64& rng, int plies, Candidate& candidate) {
+    Position pos;
+    pos.clear();
+    std::string moves;
+    for (int ply = 0; ply < plies; ++ply) {
+        int columns[WIDTH];
+        int nr_columns = 0;
+        for (int x=0; x<WIDTH; ++x)
+            if (pos.playable(x)) columns[nr_columns++] = x;
+        if (!nr_columns) return false;
+        int x = columns[rng() % nr_columns];
+        pos = pos.play(x);
+        if (pos.won()) return false;
+        moves += static_cast<char>('1' + x);
+    }
+    candidate = Candidate{moves, pos};
+    return true;
+}
+
+struct Result {
+    int score;
+    // 0 if the search went over the visit budget
+    uint64_t visits;
+};
+
+// Solve positions in nr_procs forked processes. Each gets its own copy of
+// the transposition table, which is cleared before every solve
+std::vector<Result> solve(std::vector<Candidate> const& candidates,
+                          uint nr_procs, uint64_t budget) {
+    std::vector<Result> results(candidates.size(), Result{0, 0});
+    std::vector<std::pair<pid_t, int>> children;
+    for (uint p = 0; p < nr_procs; ++p) {
+        int fds[2];
+        if (pipe(fds)) throw_errno("Could not create pipe");
+        std::cout.flush();
+        pid_t pid = fork();
+        if (pid < 0) throw_errno("Could not fork");
+        if (pid == 0) {
+            close(fds[0]);
+            FILE* out = fdopen(fds[1], "w");
+            if (!out) _exit(EXIT_FAILURE);
+            try {
+                for (size_t i = p; i < candidates.size(); i += nr_procs) {
+                    Position::reset();
+                    Position::visit_budget(budget);
+                    try {
+                        int score = candidates[i].pos.solve();
+                        fprintf(out, "%zu %d %llu\n", i, score,
+                                static_cast<unsigned long long>(Position::nr_visits()));
+                    } catch (Interrupted&) {
+                        // Too hard for any bucket
+                    }
+                }
+            } catch (std::exception& e) {
+                std::cerr << "Solver process failed: " << e.what() << std::endl;
+                _exit(EXIT_FAILURE);
+            }
+            _exit(fclose(out) ? EXIT_FAILURE : EXIT_SUCCESS);
+        }
+        close(fds[1]);
+        children.emplace_back(pid, fds[0]);
+    }
+    bool failed = false;
+    for (auto const& child: children) {
+        FILE* in = fdopen(child.second, "r");
+        if (!in) throw_errno("Could not read from solver process");
+        size_t i;
+        int score;
+        unsigned long long visits;
+        while (fscanf(in, "%zu %d %llu", &i, &score, &visits) == 3)
+            if (i < results.size()) results[i] = Result{score, visits};
+        fclose(in);
+        int status;
+        if (waitpid(child.first, &status, 0) < 0)
+            throw_errno("Could not wait for solver process");
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+            failed = true;
+    }
+    if (failed) throw_logic("A solver process failed");
+    return results;
+}
+
+}
+
+int main([[maybe_unused]] int argc,
+         char const* const* argv) {
+    init_system();
+
+    uint64_t seed = 1;
+    int min_ply = 8, max_ply = 24;
+    size_t per_bucket = 100;
+    std::vector<uint64_t> edges{10, 100, 1000, 10000, 100000, 1000000};
+    uint nr_procs = 0;
+    int transposition_bits = 20;
+    size_t batch = 1000;
+    size_t max_candidates = 1000000;
+    std::string prefix = "Corpus";
+
+    GetOpt options{"s:p:n:b:j:T:B:N:o:", argv};
+    long long tmp;
+    while (options.next())
+        switch (options.option()) {
+            case 's': seed = strtoull(options.arg(), nullptr, 0); break;
+            case 'p':
+              if (sscanf(options.arg(), "%d-%d", &min_ply, &max_ply) != 2 ||
+                  min_ply < 0 || max_ply >= AREA || min_ply > max_ply)
+                  throw(std::range_error("plies must be min-max in 0-" + std::to_string(AREA-1)));
+              break;
+            case 'n':
+              tmp = atoll(options.arg());
+              if (tmp <= 0) throw(std::range_error("positions per bucket must be positive"));
+              per_bucket = tmp;
+              break;
+            case 'b': {
+                edges.clear();
+                std::istringstream list{options.arg()};
+                std::string edge;
+                while (getline(list, edge, ',')) {
+                    uint64_t value = strtoull(edge.c_str(), nullptr, 0);
+                    if (!edges.empty() && value <= edges.back())
+                        throw(std::range_error("bucket edges must increase"));
+                    edges.emplace_back(value);
+                }
+                if (edges.size() < 2) throw(std::range_error("Need at least 2 bucket edges"));
+                break;
+            }
+            case 'j':
+              tmp = atoll(options.arg());
+              if (tmp < 0) throw(std::range_error("processes must not be negative"));
+              nr_procs = tmp;
+              break;
+            case 'T':
+              tmp = atoll(options.arg());
+              if (tmp <= 0 || tmp >= static_cast<int>(sizeof(size_t) * CHAR_BIT))
+                  throw(std::range_error("Invalid transposition_bits"));
+              transposition_bits = tmp;
+              break;
+            case 'B':
+              tmp = atoll(options.arg());
+              if (tmp <= 0) throw(std::range_error("batch must be positive"));
+              batch = tmp;
+              break;
+            case 'N':
+              tmp = atoll(options.arg());
+              if (tmp <= 0) throw(std::range_error("max candidates must be positive"));
+              max_candidates = tmp;
+              break;
+            case 'o': prefix = options.arg(); break;
+            default:
+              std::cerr << "usage: " << argv[0] << " [-s seed] [-p min_ply-max_ply] [-n positions_per_bucket] [-b edge,edge,...] [-j processes] [-T transposition_bits] [-B batch] [-N max_candidates] [-o prefix]" << std::endl;
+              exit(EXIT_FAILURE);
+        }
+    if (nr_procs == 0) nr_procs = NR_CPU;
+
+    // Bucket b holds positions needing edges[b] <= visits < edges[b+1]
+    size_t nr_buckets = edges.size() - 1;
+    std::vector<std::vector<std::string>> buckets(nr_buckets);
+    std::unordered_set<Bitmap> seen;
+    Position::init(static_cast<size_t>(1) << transposition_bits);
+
+    auto full = [&]() {
+        for (auto const& bucket: buckets)
+            if (bucket.size() < per_bucket) return false;
+        return true;
+    };
+    size_t next = 0;
+    while (!full() && next < max_candidates) {
+        std::vector<Candidate> candidates;
+        for (size_t end = std::min(next + batch, max_candidates); next < end; ++next) {
+            std::mt19937_64 rng{seed ^ (next * UINT64_C(0x9e3779b97f4a7c15))};
+            int plies = min_ply + rng() % (max_ply - min_ply + 1);
+            Candidate candidate;
+            if (!playout(rng, plies, candidate)) continue;
+            // Mirror images are the same benchmark
+            if (!seen.insert(candidate.pos.canonical_key()).second) continue;
+            candidates.emplace_back(candidate);
+        }
+        auto results = solve(candidates, nr_procs, edges.back());
+        for (size_t i=0; i<candidates.size(); ++i) {
+            auto visits = results[i].visits;
+            if (visits < edges.front() || visits >= edges.back()) continue;
+            size_t b = std::upper_bound(edges.begin(), edges.end(), visits) - edges.begin() - 1;
+            if (buckets[b].size() >= per_bucket) continue;
+            buckets[b].emplace_back(candidates[i].moves + " " + std::to_string(results[i].score));
+        }
+        std::cout << next << " candidates:";
+        for (auto const& bucket: buckets) std::cout << " " << bucket.size();
+        std::cout << std::endl;
+    }
+
+    for (size_t b=0; b<nr_buckets; ++b) {
+        std::string file = prefix + "_V" + std::to_string(edges[b]);
+        std::ofstream out;
+        out.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+        out.open(file);
+        for (auto const& line: buckets[b]) out << line << "\n";
+        out.close();
+        std::cout << file << ": " << buckets[b].size() << " positions with " << edges[b] << " <= visits < " << edges[b+1] << "\n";
+    }
+    if (!full())
+        std::cout << "Some buckets are not full after " << next << " candidates (raise -N)" << std::endl;
+    return 0;
+}
@@ -0,0 +1,291 @@
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <queue>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "endgame.hpp"
+#include "enumerate.hpp"
+#include "pool.hpp"
+
+struct Endgame::Header {
+    char magic[8];
+    uint32_t width, height;
+    uint32_t plies, reserved;
+    uint64_t size;
+};
+
+namespace {
+
+char const MAGIC[8] = "C4ENDGM";
+
+// Number of positions a task scores at a time
+size_t const BLOCK = 1 << 12;
+// Entries a level file of the final merge reads at a time
+size_t const MERGE_BUFFER = 1 << 13;
+
+ALWAYS_INLINE
+uint64_t pack(Bitmap key, int score) {
+    return key << SCORE_BITS | static_cast<uint64_t>(score + (MAX_SCORE+1));
+}
+
+// A file of packed entries sorted on key, memory mapped read only so the
+// kernel can drop its pages again instead of it counting against the
+// memory budget
+class Scores {
+  public:
+    explicit Scores(std::string const& file) {
+        int fd = open(file.c_str(), O_RDONLY);
+        if (fd < 0) throw_errno("Could not open '" + file + "'");
+        struct stat st;
+        if (fstat(fd, &st)) {
+            int err = errno;
+            close(fd);
+            throw_errno(err, "Could not stat '" + file + "'");
+        }
+        size_ = st.st_size / sizeof(uint64_t);
+        if (size_) {
+            void* map = mmap(nullptr, size_ * sizeof(uint64_t), PROT_READ, MAP_SHARED, fd, 0);
+            int err = errno;
+            if (map == MAP_FAILED) {
+                close(fd);
+                throw_errno(err, "Could not mmap '" + file + "'");
+            }
+            entries_ = static_cast<uint64_t const*>(map);
+        }
+        close(fd);
+    }
+    ~Scores() {
+        if (entries_) munmap(const_cast<uint64_t*>(entries_), size_ * sizeof(uint64_t));
+    }
+    Scores(Scores const&) = delete;
+    Scores& operator=(Scores const&) = delete;
+
+    // Score of the player to move in key, which must be there
+    int score(Bitmap key) const {
+        auto end = entries_ + size_;
+        auto it = std::lower_bound(entries_, end, pack(key, -MAX_SCORE-1));
+        if (it == end || (*it >> SCORE_BITS) != key)
+            throw_logic("Child missing from the next level");
+        return static_cast<int>(*it & SCORE_MASK) - (MAX_SCORE+1);
+    }
+
+  private:
+    uint64_t const* entries_ = nullptr;
+    size_t size_ = 0;
+};
+
+// Exact score of pos given the scores of all positions one ply later
+int retrograde_score(Position const& pos, Scores const* next) {
+    if (pos.won()) return -pos.score();
+    int score = INT_MIN;
+    for (int x=0; x<WIDTH; ++x) {
+        if (!pos.playable(x)) continue;
+        int s = -next->score(pos.play(x).key());
+        if (s > score) score = s;
+    }
+    // Full board
+    if (score == INT_MIN) return 0;
+    return score;
+}
+
+void write_entries(std::ofstream& out, std::vector<uint64_t> const& entries) {
+    out.write(reinterpret_cast<char const*>(entries.data()),
+              entries.size() * sizeof(entries[0]));
+}
+
+// Sequential buffered reader of a file of packed entries
+class EntryReader {
+  public:
+    explicit EntryReader(std::string const& file): buffer_(MERGE_BUFFER) {
+        in_.exceptions(std::ifstream::badbit);
+        in_.open(file, std::ifstream::binary);
+        if (!in_) throw_errno("Could not open '" + file + "'");
+    }
+    bool next(uint64_t& entry) {
+        if (pos_ == end_) {
+            in_.read(reinterpret_cast<char*>(buffer_.data()),
+                     buffer_.size() * sizeof(buffer_[0]));
+            end_ = in_.gcount() / sizeof(buffer_[0]);
+            pos_ = 0;
+            if (end_ == 0) return false;
+        }
+        entry = buffer_[pos_++];
+        return true;
+    }
+  private:
+    std::ifstream in_;
+    std::vector<uint64_t> buffer_;
+    size_t pos_ = 0;
+    size_t end_ = 0;
+};
+
+std::string level_file(std::string const& dir, int ply, char const* what) {
+    char name[30];
+    snprintf(name, sizeof(name), "/ply-%02d.%s", ply, what);
+    return dir + name;
+}
+
+}
+
+void Endgame::build(std::vector<Position> const& roots, int plies,
+                    std::string const& dir, std::string const& file,
+                    size_t memory, uint nr_threads) {
+    if (roots.empty()) throw_logic("No roots for the endgame database");
+    std::map<int, std::vector<Position>> by_ply;
+    for (auto const& root: roots) by_ply[root.nr_plies()].emplace_back(root);
+    int first = by_ply.begin()->first;
+    int last  = std::max(first, AREA - plies);
+
+    // Forward: enumerate every reachable position
+    Enumerator enumerator{dir, memory, nr_threads};
+    enumerator.start(by_ply.begin()->second);
+    for (int ply = first; ply < AREA; ++ply) {
+        auto found = by_ply.find(ply+1);
+        enumerator.expand(ply, found == by_ply.end() ? std::vector<Position>{} : found->second);
+        if (ply < last) enumerator.remove(ply);
+    }
+
+    // Backward: score each level from the next one. A level is scored in
+    // chunks that fit in half the memory budget, each level goes to disk
+    // as all its scores (which the level before looks up) and as its
+    // database entries
+    size_t chunk = memory / 2 / (sizeof(Position) + sizeof(uint64_t)) / BLOCK * BLOCK;
+    if (chunk < BLOCK) chunk = BLOCK;
+    std::unique_ptr<Scores> next;
+    std::vector<std::string> entry_files;
+    uint64_t nr_entries = 0;
+    for (int ply = AREA; ply >= last; --ply) {
+        std::string scores_file = level_file(dir, ply, "scores");
+        entry_files.emplace_back(level_file(dir, ply, "entries"));
+        std::ofstream scores_out, entries_out;
+        scores_out.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+        entries_out.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+        scores_out.open(scores_file, std::ofstream::binary | std::ofstream::trunc);
+        entries_out.open(entry_files.back(), std::ofstream::binary | std::ofstream::trunc);
+
+        std::vector<Position> positions;
+        std::vector<uint64_t> current, entries;
+        positions.reserve(chunk);
+        auto score_chunk = [&]() {
+            current.resize(positions.size());
+            TaskPool{(positions.size() + BLOCK-1) / BLOCK, nr_threads,
+                    [&](size_t block, uint) {
+                size_t end = std::min(positions.size(), (block+1) * BLOCK);
+                for (size_t i = block * BLOCK; i < end; ++i)
+                    current[i] = pack(positions[i].key(), retrograde_score(positions[i], next.get()));
+            }}.join();
+            // A search never asks about a won position
+            entries.clear();
+            for (size_t i=0; i<positions.size(); ++i)
+                if (!positions[i].won()) entries.emplace_back(current[i]);
+            // Level files are sorted on key, so these are too
+            write_entries(scores_out, current);
+            write_entries(entries_out, entries);
+            nr_entries += entries.size();
+            positions.clear();
+        };
+        enumerator.scan(ply, [&](Enumerator::Record const& record) {
+            positions.emplace_back(record.position());
+            if (positions.size() == chunk) score_chunk();
+        });
+        score_chunk();
+        scores_out.close();
+        entries_out.close();
+        if (next) unlink(level_file(dir, ply+1, "scores").c_str());
+        next.reset(new Scores{scores_file});
+        enumerator.remove(ply);
+    }
+    next.reset();
+    unlink(level_file(dir, last, "scores").c_str());
+
+    Header header;
+    std::copy(std::begin(MAGIC), std::end(MAGIC), header.magic);
+    header.width    = WIDTH;
+    header.height   = HEIGHT;
+    header.plies    = AREA - last;
+    header.reserved = 0;
+    header.size     = nr_entries;
+    std::ofstream out;
+    out.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+    out.open(file, std::ofstream::binary | std::ofstream::trunc);
+    out.write(reinterpret_cast<char const*>(&header), sizeof(header));
+
+    // Keys of different plies differ, so merging the sorted levels gives
+    // the sorted database
+    std::vector<std::unique_ptr<EntryReader>> readers;
+    typedef std::pair<uint64_t, size_t> Head;
+    std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+    for (auto const& entry_file: entry_files) {
+        readers.emplace_back(new EntryReader{entry_file});
+        uint64_t entry;
+        if (readers.back()->next(entry)) heads.emplace(entry, readers.size()-1);
+    }
+    std::vector<uint64_t> buffer;
+    buffer.reserve(MERGE_BUFFER);
+    while (!heads.empty()) {
+        auto head = heads.top();
+        heads.pop();
+        buffer.emplace_back(head.first);
+        if (buffer.size() == MERGE_BUFFER) {
+            write_entries(out, buffer);
+            buffer.clear();
+        }
+        uint64_t entry;
+        if (readers[head.second]->next(entry)) heads.emplace(entry, head.second);
+    }
+    write_entries(out, buffer);
+    out.close();
+    readers.clear();
+    for (auto const& entry_file: entry_files) unlink(entry_file.c_str());
+}
+
+Endgame::Endgame(std::string const& file) {
+    int fd = open(file.c_str(), O_RDONLY);
+    if (fd < 0) throw_errno("Could not open '" + file + "'");
+    struct stat st;
+    if (fstat(fd, &st)) {
+        int err = errno;
+        close(fd);
+        throw_errno(err, "Could not stat '" + file + "'");
+    }
+    map_size_ = st.st_size;
+    if (map_size_ < sizeof(Header)) {
+        close(fd);
+        throw_logic("Endgame database '" + file + "' is truncated");
+    }
+    map_ = mmap(nullptr, map_size_, PROT_READ, MAP_SHARED, fd, 0);
+    int err = errno;
+    close(fd);
+    if (map_ == MAP_FAILED) {
+        map_ = nullptr;
+        throw_errno(err, "Could not mmap '" + file + "'");
+    }
+    auto header = static_cast<Header const*>(map_);
+    if (!std::equal(std::begin(MAGIC), std::end(MAGIC), header->magic) ||
+        header->width != WIDTH || header->height != HEIGHT ||
+        sizeof(Header) + header->size * sizeof(uint64_t) != map_size_) {
+        munmap(map_, map_size_);
+        throw_logic("'" + file + "' is not an endgame database for this board");
+    }
+    plies_   = header->plies;
+    size_    = header->size;
+    entries_ = reinterpret_cast<uint64_t const*>(header+1);
+    madvise(map_, map_size_, MADV_WILLNEED);
+
+    buckets_.resize((ONE << BUCKET_BITS) + 1);
+    size_t i = 0;
+    for (size_t bucket=0; bucket < buckets_.size(); ++bucket) {
+        while (i < size_ && (entries_[i] >> (SCORE_BITS+BUCKET_SHIFT)) < bucket) ++i;
+        buckets_[bucket] = i;
+    }
+}
+
+Endgame::~Endgame() {
+    if (map_) munmap(map_, map_size_);
+}
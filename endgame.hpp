@@ -0,0 +1,65 @@
+#ifndef endgame_hpp
+# define endgame_hpp 1
+
+#include <string>
+#include <vector>
+
+#include "position.hpp"
+
+// Exact scores of all positions with at most plies() empty cells that can
+// be reached from a set of roots. Entries are key << SCORE_BITS | score
+// sorted on key and get memory mapped from a file. A table on the top key
+// bits narrows the binary search down to a few cache lines
+class Endgame {
+  public:
+    // Load a database written by build
+    explicit Endgame(std::string const& file);
+    ~Endgame();
+    Endgame(Endgame const&) = delete;
+    Endgame& operator=(Endgame const&) = delete;
+
+    // Enumerate everything reachable from roots (in work directory dir)
+    // and compute the scores by retrograde analysis, starting from the
+    // full board and working back to positions with plies empty cells.
+    // Levels are scored in chunks and kept on disk, so memory bounds both
+    // passes
+    static void build(std::vector<Position> const& roots, int plies,
+                      std::string const& dir, std::string const& file,
+                      size_t memory, uint nr_threads = 0);
+
+    int plies() const { return plies_; }
+    size_t size() const { return size_; }
+
+    // Exact score of pos (which must not be won) for the player to move
+    ALWAYS_INLINE
+    bool probe(Bitmap key, int& score) const {
+        Bitmap bucket = key >> BUCKET_SHIFT;
+        uint64_t const* low  = entries_ + buckets_[bucket];
+        uint64_t const* high = entries_ + buckets_[bucket+1];
+        Bitmap target = key << SCORE_BITS;
+        while (low < high) {
+            auto mid = low + (high - low) / 2;
+            if (*mid < target) low = mid+1;
+            else high = mid;
+        }
+        if (low == entries_ + size_ || (*low >> SCORE_BITS) != key)
+            return false;
+        score = static_cast<int>(*low & SCORE_MASK) - (MAX_SCORE+1);
+        return true;
+    }
+
+  private:
+    static int const BUCKET_BITS  = 16;
+    static int const BUCKET_SHIFT = KEY_BITS - BUCKET_BITS;
+
+    struct Header;
+
+    void* map_ = nullptr;
+    size_t map_size_ = 0;
+    uint64_t const* entries_ = nullptr;
+    size_t size_ = 0;
+    int plies_ = -1;
+    std::vector<size_t> buckets_;
+};
+
+#endif /* endgame_hpp */
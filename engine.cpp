@@ -0,0 +1,123 @@
+#include <algorithm>
+#include <sstream>
+
+#include <cstdlib>
+
+#include "engine.hpp"
+
+void Engine::run(std::istream& in, std::ostream& out) {
+    std::string line;
+    while (getline(in, line)) {
+        auto received = Clock::now();
+        ponder_stop();
+        std::istringstream words{line};
+        std::string command;
+        if (!(words >> command)) continue;
+        if (command == "quit") break;
+        if (command == "new") {
+            std::string moves;
+            words >> moves;
+            Position pos;
+            try {
+                pos = Position{moves};
+            } catch (std::exception& e) {
+                out << "error invalid moves " << moves << std::endl;
+                continue;
+            }
+            Position::reset(false);
+            pos_ = pos;
+            opponent_moved_ = false;
+            out << "ok" << std::endl;
+        } else if (command == "move") {
+            int x;
+            if (game_over()) {
+                out << "gameover" << std::endl;
+                continue;
+            }
+            if (!(words >> x) || x < 1 || x > WIDTH || !pos_.playable(x-1)) {
+                out << "error invalid move" << std::endl;
+                continue;
+            }
+            if (to_ponder_)
+                out << "info pondered " << pondered_ << "/" << to_ponder_ << " replies, " << ponder_visits_ << " visits" << std::endl;
+            to_ponder_ = 0;
+            pos_ = pos_.play(x-1);
+            received_ = received;
+            opponent_moved_ = true;
+            if (game_over()) out << "gameover" << std::endl;
+            else out << "ok" << std::endl;
+        } else if (command == "go") {
+            uint64_t limit = limit_;
+            words >> limit;
+            // Without an opponent move latency counts from the go itself
+            if (!opponent_moved_) received_ = received;
+            go(out, limit);
+        } else if (command == "show") {
+            out << pos_;
+        } else
+            out << "error unknown command " << command << std::endl;
+    }
+}
+
+void Engine::go(std::ostream& out, uint64_t limit) {
+    if (game_over()) {
+        out << "gameover" << std::endl;
+        return;
+    }
+    Position::reset(true);
+    if (limit) Position::deadline(Clock::now() + std::chrono::milliseconds(limit));
+    int best;
+    std::string score;
+    try {
+        int s = pos_.solve(method_);
+        score = std::to_string(s);
+        // Only looks at the table, so nothing runs past the deadline
+        best = pos_.best_move(s, method_);
+    } catch (Interrupted& interrupted) {
+        best = interrupted.best;
+        score = "[" + std::to_string(interrupted.min) + "," + std::to_string(interrupted.max) + "]";
+    }
+    Position::no_limits();
+    // Interrupted before any move was looked at
+    for (int x=0; best < 0 && x<WIDTH; ++x)
+        if (pos_.playable(x)) best = x;
+    pos_ = pos_.play(best);
+    auto latency = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - received_).count();
+    out << "bestmove " << best+1 << " score " << score << " latency " << latency << " visits " << Position::nr_visits() << std::endl;
+    opponent_moved_ = false;
+    if (game_over()) out << "gameover" << std::endl;
+    else ponder_start();
+}
+
+void Engine::ponder_start() {
+    pondered_ = 0;
+    to_ponder_ = 0;
+    ponder_visits_ = 0;
+    for (int x=0; x<WIDTH; ++x)
+        if (pos_.playable(x)) ++to_ponder_;
+    ponder_ = std::thread{&Engine::ponder, this, pos_};
+}
+
+void Engine::ponder_stop() {
+    if (!ponder_.joinable()) return;
+    Position::interrupt();
+    ponder_.join();
+    Position::interrupt(false);
+}
+
+void Engine::ponder(Position pos) {
+    // Center moves are the most likely replies
+    std::array<int, WIDTH> order;
+    for (int i=0; i<WIDTH; ++i) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [](int l, int r) {
+        return std::abs(2*l-(WIDTH-1)) < std::abs(2*r-(WIDTH-1));
+    });
+    try {
+        for (int x: order) {
+            if (!pos.playable(x)) continue;
+            pos.play(x).solve(method_);
+            ++pondered_;
+        }
+    } catch (Interrupted&) {}
+    ponder_visits_ = Position::nr_visits();
+}
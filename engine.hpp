@@ -0,0 +1,48 @@
+#ifndef engine_hpp
+# define engine_hpp 1
+
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "position.hpp"
+
+// Interactive play engine. Reads commands line by line:
+//   new [moves]   Start a new game (optionally after the given moves)
+//   move <column> The opponent plays in column (1 based)
+//   go [ms]       Play a move, thinking at most ms milliseconds
+//   show          Show the current position
+//   quit          Stop
+// Between our move and the opponent's move the likely replies are solved
+// into the shared transposition table (pondering)
+class Engine {
+  public:
+    Engine(int method, uint64_t limit): method_{method}, limit_{limit} {}
+    ~Engine() { ponder_stop(); }
+    void run(std::istream& in, std::ostream& out);
+
+  private:
+    typedef Position::Clock Clock;
+
+    void go(std::ostream& out, uint64_t limit);
+    void ponder_start();
+    void ponder_stop();
+    void ponder(Position pos);
+    bool game_over() const {
+        return pos_.won() || !pos_.possible_bits();
+    }
+
+    Position pos_{""};
+    int const method_;
+    uint64_t const limit_;
+    // When the move we have to answer was received
+    Clock::time_point received_;
+    bool opponent_moved_ = false;
+    std::thread ponder_;
+    // Written by the ponder thread, read after joining it
+    int pondered_ = 0;
+    int to_ponder_ = 0;
+    uint64_t ponder_visits_ = 0;
+};
+
+#endif /* engine_hpp */
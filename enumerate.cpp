@@ -0,0 +1,332 @@
+#include <algorithm>
+#include <array>
+#include <fstream>
+#include <memory>
+#include <queue>
+#include <type_traits>
+
+#include <cerrno>
+#include <cstdio>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "enumerate.hpp"
+#include "pool.hpp"
+
+static_assert(std::is_trivially_copyable<Enumerator::Record>::value,
+              "Records are written to disk as is");
+
+namespace {
+
+// Number of records a worker reads from the previous level at a time
+size_t const BLOCK = 1 << 16;
+// Smallest read buffer of a merge input, in records (64 KiB)
+size_t const MIN_MERGE_BUFFER = 1 << 12;
+
+ALWAYS_INLINE
+uint64_t add_paths(uint64_t a, uint64_t b) {
+    uint64_t sum = a + b;
+    return sum < a ? UINT64_MAX : sum;
+}
+
+// LSD radix sort on the key, 8 bits at a time
+void radix_sort(std::vector<Enumerator::Record>& records,
+                std::vector<Enumerator::Record>& scratch) {
+    scratch.resize(records.size());
+    for (int shift = 0; shift < KEY_BITS; shift += 8) {
+        std::array<size_t, 256> count{};
+        for (auto const& record: records)
+            ++count[record.key >> shift & 0xff];
+        // Skip digits where all records are the same
+        if (std::find(count.begin(), count.end(), records.size()) != count.end())
+            continue;
+        size_t sum = 0;
+        for (auto& c: count) {
+            auto tmp = c;
+            c = sum;
+            sum += tmp;
+        }
+        for (auto const& record: records)
+            scratch[count[record.key >> shift & 0xff]++] = record;
+        records.swap(scratch);
+    }
+}
+
+void dedupe(std::vector<Enumerator::Record>& records) {
+    if (records.empty()) return;
+    size_t out = 0;
+    for (size_t i=1; i<records.size(); ++i) {
+        if (records[i].key == records[out].key)
+            records[out].paths = add_paths(records[out].paths, records[i].paths);
+        else
+            records[++out] = records[i];
+    }
+    records.resize(out+1);
+}
+
+void write_records(std::string const& file,
+                   std::vector<Enumerator::Record> const& records) {
+    std::ofstream out;
+    out.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+    out.open(file, std::ofstream::binary | std::ofstream::trunc);
+    out.write(reinterpret_cast<char const*>(records.data()),
+              records.size() * sizeof(records[0]));
+    out.close();
+}
+
+// Sequential buffered reader of a record file
+class Reader {
+  public:
+    explicit Reader(std::string const& file, size_t records = BLOCK):
+        buffer_(records) {
+        in_.exceptions(std::ifstream::badbit);
+        in_.open(file, std::ifstream::binary);
+        if (!in_) throw_errno("Could not open '" + file + "'");
+    }
+    bool next(Enumerator::Record& record) {
+        if (pos_ == end_) {
+            in_.read(reinterpret_cast<char*>(buffer_.data()),
+                     buffer_.size() * sizeof(buffer_[0]));
+            end_ = in_.gcount() / sizeof(buffer_[0]);
+            pos_ = 0;
+            if (end_ == 0) return false;
+        }
+        record = buffer_[pos_++];
+        return true;
+    }
+  private:
+    std::ifstream in_;
+    std::vector<Enumerator::Record> buffer_;
+    size_t pos_ = 0;
+    size_t end_ = 0;
+};
+
+}
+
+Enumerator::Enumerator(std::string const& dir, size_t memory, uint nr_threads):
+    dir_{dir}, memory_{memory}, nr_threads_{nr_threads ? nr_threads : NR_CPU} {
+    if (mkdir(dir.c_str(), 0777) && errno != EEXIST)
+        throw_errno("Could not create directory '" + dir + "'");
+}
+
+std::string Enumerator::file(int ply) const {
+    char name[20];
+    snprintf(name, sizeof(name), "/ply-%02d.level", ply);
+    return dir_ + name;
+}
+
+Enumerator::Level Enumerator::start(std::vector<Position> const& roots) {
+    if (roots.empty()) throw_logic("No roots to enumerate");
+    int ply = roots[0].nr_plies();
+    std::vector<Record> records;
+    for (auto const& root: roots) {
+        if (root.nr_plies() != ply) throw_logic("Roots at different plies");
+        records.emplace_back(Record{root.key(), 1});
+    }
+    std::vector<Record> scratch;
+    radix_sort(records, scratch);
+    dedupe(records);
+    write_records(file(ply), records);
+    Level level;
+    level.ply = ply;
+    for (auto const& record: records) {
+        ++level.positions;
+        level.paths = add_paths(level.paths, record.paths);
+        if (record.position().won()) ++level.won;
+    }
+    return level;
+}
+
+void Enumerator::flush(Worker& worker, int ply, uint id) {
+    if (worker.buffer.empty()) return;
+    std::vector<Record> scratch;
+    radix_sort(worker.buffer, scratch);
+    dedupe(worker.buffer);
+    char name[40];
+    snprintf(name, sizeof(name), "/run-%02d-%u-%zu.tmp", ply, id, worker.runs.size());
+    worker.runs.emplace_back(dir_ + name);
+    write_records(worker.runs.back(), worker.buffer);
+    worker.buffer.clear();
+}
+
+Enumerator::Level Enumerator::expand(int ply, std::vector<Position> const& extra) {
+    std::string in_file = file(ply);
+    struct stat st;
+    if (stat(in_file.c_str(), &st))
+        throw_errno("Could not stat '" + in_file + "'");
+    size_t nr_records = st.st_size / sizeof(Record);
+    size_t nr_blocks  = (nr_records + BLOCK - 1) / BLOCK;
+
+    // Half the budget for the buffer, half for the radix sort scratch
+    size_t capacity = memory_ / nr_threads_ / (2 * sizeof(Record));
+    if (capacity < WIDTH) capacity = WIDTH;
+    std::vector<Worker> workers(nr_threads_);
+    for (auto& worker: workers) worker.buffer.reserve(capacity);
+
+    int fd = open(in_file.c_str(), O_RDONLY);
+    if (fd < 0) throw_errno("Could not open '" + in_file + "'");
+    {
+        TaskPool pool{nr_blocks, nr_threads_, [&](size_t block, uint id) {
+            auto& worker = workers[id];
+            std::vector<Record> records(std::min(BLOCK, nr_records - block * BLOCK));
+            size_t bytes = records.size() * sizeof(Record);
+            ssize_t got = pread(fd, records.data(), bytes, block * BLOCK * sizeof(Record));
+            if (got != static_cast<ssize_t>(bytes))
+                throw_errno("Could not read '" + in_file + "'");
+            std::vector<Position> positions(records.size());
+            std::vector<Bitmap> keys(records.size());
+            for (size_t i=0; i<records.size(); ++i) keys[i] = records[i].key;
+            Position::decode(keys.data(), positions.data(), keys.size());
+            for (size_t i=0; i<records.size(); ++i) {
+                auto const& pos = positions[i];
+                // The game is over
+                if (pos.won()) continue;
+                for (int x=0; x<WIDTH; ++x) {
+                    if (!pos.playable(x)) continue;
+                    if (worker.buffer.size() >= capacity)
+                        flush(worker, ply+1, id);
+                    worker.buffer.emplace_back(Record{pos.play(x).key(), records[i].paths});
+                }
+            }
+        }};
+        try {
+            pool.join();
+        } catch (...) {
+            close(fd);
+            throw;
+        }
+    }
+    close(fd);
+    for (auto const& pos: extra) {
+        if (pos.nr_plies() != ply+1) throw_logic("Extra position at wrong ply");
+        if (workers[0].buffer.size() >= capacity) flush(workers[0], ply+1, 0);
+        workers[0].buffer.emplace_back(Record{pos.key(), 1});
+    }
+
+    std::vector<std::string> runs;
+    for (uint id=0; id<workers.size(); ++id) {
+        flush(workers[id], ply+1, id);
+        runs.insert(runs.end(), workers[id].runs.begin(), workers[id].runs.end());
+    }
+    workers.clear();
+    return merge(std::move(runs), ply+1);
+}
+
+// Merge sorted runs into file, adding up the paths of equal keys. Each
+// input gets a buffer of records records, and so does the output. Adds
+// to level if given. Removes the runs
+void Enumerator::merge_runs(std::vector<std::string> const& runs,
+                            std::string const& file, size_t records,
+                            Level* level) {
+    std::vector<std::unique_ptr<Reader>> readers;
+    std::vector<Record> current(runs.size());
+    auto later = [&](size_t l, size_t r) {
+        return current[l].key > current[r].key;
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(later)> heap{later};
+    for (size_t i=0; i<runs.size(); ++i) {
+        readers.emplace_back(new Reader{runs[i], records});
+        if (readers[i]->next(current[i])) heap.push(i);
+    }
+
+    std::ofstream out;
+    out.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+    out.open(file, std::ofstream::binary | std::ofstream::trunc);
+    std::vector<Record> buffer;
+    buffer.reserve(records);
+    auto emit = [&](Record const& record) {
+        if (level) {
+            ++level->positions;
+            level->paths = add_paths(level->paths, record.paths);
+            if (record.position().won()) ++level->won;
+        }
+        buffer.emplace_back(record);
+        if (buffer.size() == records) {
+            out.write(reinterpret_cast<char const*>(buffer.data()),
+                      buffer.size() * sizeof(buffer[0]));
+            buffer.clear();
+        }
+    };
+
+    bool have = false;
+    Record record;
+    while (!heap.empty()) {
+        size_t i = heap.top();
+        heap.pop();
+        if (have && current[i].key == record.key)
+            record.paths = add_paths(record.paths, current[i].paths);
+        else {
+            if (have) emit(record);
+            record = current[i];
+            have = true;
+        }
+        if (readers[i]->next(current[i])) heap.push(i);
+    }
+    if (have) emit(record);
+    out.write(reinterpret_cast<char const*>(buffer.data()),
+              buffer.size() * sizeof(buffer[0]));
+    out.close();
+
+    readers.clear();
+    for (auto const& run: runs) unlink(run.c_str());
+}
+
+// Merge the runs into the level file of ply, at most fan_in runs at a
+// time. The fan in is limited by the memory budget (every input and the
+// output get an equal share, at least MIN_MERGE_BUFFER records) and by
+// the number of files we may open. More runs than that are merged in
+// passes, through intermediate runs
+Enumerator::Level Enumerator::merge(std::vector<std::string> runs, int ply) {
+    size_t fan_in = memory_ / (MIN_MERGE_BUFFER * sizeof(Record));
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit))
+        throw_errno("Could not get the open files limit");
+    // Leave room for the files the rest of the program has open
+    if (limit.rlim_cur != RLIM_INFINITY)
+        fan_in = std::min<size_t>(fan_in, limit.rlim_cur / 2);
+    // Needs 2 to make progress, even if that goes over the budget
+    fan_in = std::max<size_t>(fan_in - 1, 2);
+
+    for (int pass = 0; runs.size() > fan_in; ++pass) {
+        size_t records = std::max(MIN_MERGE_BUFFER, memory_ / (fan_in+1) / sizeof(Record));
+        std::vector<std::string> merged;
+        for (size_t begin = 0; begin < runs.size(); begin += fan_in) {
+            size_t end = std::min(runs.size(), begin + fan_in);
+            char name[50];
+            snprintf(name, sizeof(name), "/run-%02d-pass%d-%zu.tmp", ply, pass, merged.size());
+            merged.emplace_back(dir_ + name);
+            merge_runs({runs.begin() + begin, runs.begin() + end},
+                       merged.back(), records, nullptr);
+        }
+        runs.swap(merged);
+    }
+
+    Level level;
+    level.ply = ply;
+    size_t records = std::max(MIN_MERGE_BUFFER, memory_ / (runs.size()+1) / sizeof(Record));
+    merge_runs(runs, file(ply), records, &level);
+    return level;
+}
+
+void Enumerator::scan(int ply, std::function<void(Record const&)> const& f) const {
+    Reader reader{file(ply)};
+    Record record;
+    while (reader.next(record)) f(record);
+}
+
+void Enumerator::write_keys(int ply, std::string const& file) const {
+    std::ofstream out;
+    out.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+    out.open(file, std::ofstream::binary | std::ofstream::trunc);
+    scan(ply, [&](Record const& record) {
+        out.write(reinterpret_cast<char const*>(&record.key), sizeof(record.key));
+    });
+    out.close();
+}
+
+void Enumerator::remove(int ply) const {
+    unlink(file(ply).c_str());
+}
@@ -0,0 +1,63 @@
+#ifndef enumerate_hpp
+# define enumerate_hpp 1
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "position.hpp"
+
+// Level by level enumeration of all distinct positions reachable from a
+// set of roots. A level file holds the keys of the distinct positions of
+// one ply in sorted order, each with the number of move sequences (paths) that
+// reach it. Expanding a level runs in parallel: every worker collects
+// children in a bounded buffer which is radix sorted, deduplicated and
+// written to a run file whenever it fills up. The runs are then merged
+// into the next level file, in several passes if there are more runs
+// than the budget (or the open files limit) allows to merge at once, so
+// memory use is bounded by the budget no matter how many positions there
+// are
+class Enumerator {
+  public:
+    struct Record {
+        Bitmap key;
+        // Saturates at UINT64_MAX
+        uint64_t paths;
+        Position position() const { return Position::decode_key(key); }
+    };
+    struct Level {
+        int ply = 0;
+        uint64_t positions = 0;
+        uint64_t paths     = 0;
+        uint64_t won       = 0;
+    };
+
+    Enumerator(std::string const& dir, size_t memory, uint nr_threads = 0);
+    // Create the first level from roots (which must have the same ply)
+    Level start(std::vector<Position> const& roots);
+    // Expand the level at ply into ply+1 and add the extra positions (which
+    // must be at ply+1). Won positions are not expanded
+    Level expand(int ply, std::vector<Position> const& extra = {});
+    std::string file(int ply) const;
+    void scan(int ply, std::function<void(Record const&)> const& f) const;
+    // Write the sorted keys of a level as native 64-bit words
+    void write_keys(int ply, std::string const& file) const;
+    void remove(int ply) const;
+
+  private:
+    struct Worker {
+        std::vector<Record> buffer;
+        std::vector<std::string> runs;
+    };
+
+    void flush(Worker& worker, int ply, uint id);
+    void merge_runs(std::vector<std::string> const& runs,
+                    std::string const& file, size_t records, Level* level);
+    Level merge(std::vector<std::string> runs, int ply);
+
+    std::string const dir_;
+    size_t const memory_;
+    uint const nr_threads_;
+};
+
+#endif /* enumerate_hpp */
@@ -0,0 +1,62 @@
+#ifndef getopt_hpp
+# define getopt_hpp 1
+
+#include <string>
+
+#include "constants.hpp"
+
+// Handle commandline options.
+// Simplified getopt for systems that don't have it in their library (Windows..)
+class GetOpt {
+  private:
+    std::string const options;
+    char const* const* argv;
+    int nextchar = 0;
+    int optind = 1;
+    char ch = '?';
+    char const* optarg = nullptr;
+
+  public:
+    int ind() const PURE { return optind; }
+    char const* arg() const PURE { return optarg; }
+    char const* next_arg() { return argv[optind++]; }
+    char option() const PURE { return ch; }
+
+    GetOpt(std::string const options_, char const* const* argv_) :
+        options(options_), argv(argv_) {}
+    char next() {
+        while (1) {
+            if (nextchar == 0) {
+                if (!argv[optind] ||
+                    argv[optind][0] != '-' ||
+                    argv[optind][1] == 0) return ch = 0;
+                if (argv[optind][1] == '-' && argv[optind][2] == 0) {
+                    ++optind;
+                    return ch = 0;
+                }
+                nextchar = 1;
+            }
+            ch = argv[optind][nextchar++];
+            if (ch == 0) {
+                ++optind;
+                nextchar = 0;
+                continue;
+            }
+            auto pos = options.find(ch);
+            if (pos == std::string::npos) ch = '?';
+            else if (options[pos+1] == ':') {
+                if (argv[optind][nextchar]) {
+                    optarg = &argv[optind][nextchar];
+                } else {
+                    optarg = argv[++optind];
+                    if (!optarg) return ch = options[0] == ':' ? ':' : '?';
+                }
+                ++optind;
+                nextchar = 0;
+            }
+            return ch;
+        }
+    }
+};
+
+#endif /* getopt_hpp */
@@ -0,0 +1,206 @@
+#include <array>
+
+#include "lanes.hpp"
+
+namespace {
+
+typedef Bitmap Bitmaps __attribute__((vector_size(LaneSolver::LANES * sizeof(Bitmap))));
+
+// All ones in the lanes where bits is not 0
+ALWAYS_INLINE
+Bitmaps nonzero(Bitmaps bits) { return (Bitmaps)(bits != 0); }
+
+// One node of the search of a lane
+struct Frame {
+    // As in Position: color has the stones of the player who just moved
+    Bitmap color, mask;
+    int left;
+    int alpha, beta, best;
+    int next, nr_moves;
+    Bitmap moves[WIDTH];
+};
+
+// Set up the node in frame after its evaluation. Returns true if its value
+// is already known (and puts it in value), false if there are moves to try
+ALWAYS_INLINE
+bool enter(Frame& frame, Bitmap win, Bitmap play, Bitmap lost,
+           Bitmap threats, std::array<Bitmap, WIDTH> const& move_order,
+           int& value) {
+    if (win) {
+        value = (frame.left+1)/2;
+        return true;
+    }
+    // Same scores and bounds as _alphabeta
+    if (lost || !play) {
+        value = -(frame.left/2);
+        return true;
+    }
+    // Lower bound since opponent cannot win on his next move
+    int min = 1-frame.left/2;
+    if (frame.alpha < min) {
+        frame.alpha = min;
+        if (frame.alpha >= frame.beta) {
+            value = frame.alpha;
+            return true;
+        }
+    }
+    // Upper bound since we cannot win on our next move
+    int max = (frame.left-1)/2;
+    if (frame.beta > max) {
+        frame.beta = max;
+        if (frame.alpha >= frame.beta) {
+            value = frame.beta;
+            return true;
+        }
+    }
+    // Moves that make threats first, center first within that
+    int nr_moves = 0;
+    for (auto column: move_order)
+        if (threats & column) frame.moves[nr_moves++] = threats & column;
+    Bitmap rest = play & ~threats;
+    for (auto column: move_order)
+        if (rest & column) frame.moves[nr_moves++] = rest & column;
+    frame.nr_moves = nr_moves;
+    frame.next = 0;
+    frame.best = -MAX_SCORE-1;
+    return false;
+}
+
+// A move of frame scored score. Returns true if frame is done (and puts
+// its value in value), false if there are more moves to try
+ALWAYS_INLINE
+bool leave(Frame& frame, int score, int& value) {
+    if (score >= frame.beta) {
+        value = score;
+        return true;
+    }
+    if (score > frame.best) {
+        frame.best = score;
+        if (score > frame.alpha) frame.alpha = score;
+    }
+    if (frame.next < frame.nr_moves) return false;
+    value = frame.best;
+    return true;
+}
+
+}
+
+// What the side to move can do in the positions of all lanes at once.
+// win:     moves that win immediately
+// play:    the moves left after the forced move rules of BlockForced
+// lost:    all ones if the opponent has two threats we can't both block
+// threats: the moves of play that make a threat the opponent allows
+template <class Bitmaps>
+ALWAYS_INLINE
+void LaneSolver::evaluate(Bitmaps color, Bitmaps mask,
+                          Bitmaps& win, Bitmaps& play, Bitmaps& lost,
+                          Bitmaps& threats) {
+    Bitmaps my_stones = color ^ mask;
+    Bitmaps possible  = (mask + BOTTOM_BITS) & BOARD_MASK;
+    win = Position::_winning_bits(my_stones, mask) & possible;
+    Bitmaps opponent_win = Position::_winning_bits(color, mask);
+    Bitmaps forced = opponent_win & possible;
+    lost = nonzero(forced & (forced - 1));
+    // If there is a forced move it is the only one
+    possible ^= (possible ^ forced) & nonzero(forced);
+    // Avoid playing just below a winning move for the opponent
+    possible &= ~(opponent_win >> 1);
+    play = possible;
+
+    Bitmaps opponent_allowed = Position::_allowed_bits(opponent_win);
+    threats = possible ^ possible;
+    for (auto column: Position::move_order_) {
+        Bitmaps move = possible & column;
+        Bitmaps winning = Position::_winning_bits(my_stones | move, mask);
+        threats |= move & nonzero(winning & opponent_allowed);
+    }
+}
+
+void LaneSolver::solve(std::vector<Position> const& positions,
+                       std::vector<int>& scores, std::vector<uint64_t>& visits) {
+    size_t const IDLE = SIZE_MAX;
+    size_t n = positions.size();
+    scores.assign(n, 0);
+    visits.assign(n, 0);
+
+    std::array<std::array<Frame, MAX_PLIES_LEFT+1>, LANES> stacks;
+    // The position each lane works on and how deep it is
+    std::array<size_t, LANES> current;
+    std::array<int, LANES> depth;
+    size_t next = 0;
+
+    // Give lane the next position that needs a search
+    auto start = [&](int lane) {
+        while (next < n) {
+            size_t i = next++;
+            auto const& pos = positions[i];
+            if (!fits(pos))
+                throw_logic("Position has more than " + std::to_string(MAX_PLIES_LEFT) + " empty cells");
+            int score;
+            if (pos._trivial(score)) {
+                scores[i] = score;
+                visits[i] = 1;
+                continue;
+            }
+            auto& frame = stacks[lane][0];
+            frame.color = pos.color_;
+            frame.mask  = pos.mask_;
+            frame.left  = pos.nr_plies_left();
+            pos._window(0, frame.alpha, frame.beta);
+            current[lane] = i;
+            depth[lane] = 0;
+            return;
+        }
+        current[lane] = IDLE;
+    };
+    for (int lane=0; lane<LANES; ++lane) start(lane);
+
+    Bitmaps color{}, mask{}, win, play, lost, threats;
+    while (true) {
+        bool active = false;
+        for (int lane=0; lane<LANES; ++lane) {
+            if (current[lane] == IDLE) {
+                // Evaluates as an empty board, the result is ignored
+                color[lane] = 0;
+                mask[lane]  = 0;
+                continue;
+            }
+            active = true;
+            auto const& frame = stacks[lane][depth[lane]];
+            color[lane] = frame.color;
+            mask[lane]  = frame.mask;
+        }
+        if (!active) break;
+
+        evaluate(color, mask, win, play, lost, threats);
+
+        for (int lane=0; lane<LANES; ++lane) {
+            if (current[lane] == IDLE) continue;
+            ++visits[current[lane]];
+            auto& stack = stacks[lane];
+            int d = depth[lane];
+            int value;
+            bool done = enter(stack[d], win[lane], play[lane], lost[lane],
+                              threats[lane], Position::move_order_, value);
+            // Pass values up until some node has a move left to try
+            while (done && d > 0) {
+                --d;
+                done = leave(stack[d], -value, value);
+            }
+            if (done) {
+                scores[current[lane]] = value;
+                start(lane);
+                continue;
+            }
+            auto& parent = stack[d];
+            auto& child  = stack[d+1];
+            Bitmap move  = parent.moves[parent.next++];
+            child.color = (parent.color ^ parent.mask) | move;
+            child.mask  = parent.mask | move;
+            child.left  = parent.left - 1;
+            child.alpha = -parent.beta;
+            child.beta  = -parent.alpha;
+            depth[lane] = d+1;
+        }
+    }
+}
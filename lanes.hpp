@@ -0,0 +1,37 @@
+#ifndef lanes_hpp
+# define lanes_hpp 1
+
+#include <vector>
+
+#include "position.hpp"
+
+// Solve many positions with few empty cells at once. Every lane of a
+// vector of Bitmaps runs its own alpha-beta search (without transposition
+// table) on an explicit stack. The lanes move in lockstep: each step
+// evaluates the current node of all lanes with vector instructions (wins,
+// forced moves, which moves make threats), after which every lane walks
+// its own stack to the next node. A lane whose search is done takes the
+// next position, so all lanes stay busy until the batch runs dry
+class LaneSolver {
+  public:
+    // 4 x 64 bits fills an AVX2 register
+    static int const LANES = 4;
+    // Without a table bigger searches get too expensive
+    static int const MAX_PLIES_LEFT = 16;
+
+    static bool fits(Position const& pos) {
+        return pos.nr_plies_left() <= MAX_PLIES_LEFT;
+    }
+    // Set scores to the exact (strong) scores of positions, which must all
+    // fit, and visits to the number of nodes each search took
+    static void solve(std::vector<Position> const& positions,
+                      std::vector<int>& scores, std::vector<uint64_t>& visits);
+
+  private:
+    template <class Bitmaps>
+    static void evaluate(Bitmaps color, Bitmaps mask,
+                         Bitmaps& win, Bitmaps& play, Bitmaps& lost,
+                         Bitmaps& threats);
+};
+
+#endif /* lanes_hpp */
@@ -0,0 +1,278 @@
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#include <sched.h>
+
+#include "getopt.hpp"
+#include "policy.hpp"
+#include "position.hpp"
+
+// Time the building blocks of the search in isolation, in ns per call,
+// over positions taken from books and test files. Every kernel runs over
+// the whole corpus a few times and the fastest round is reported
+
+// Make the compiler believe value is used (and can change), so loop
+// bodies are neither removed, hoisted nor vectorized
+template <class T>
+ALWAYS_INLINE
+void opaque(T& value) { asm volatile("" : "+r" (value)); }
+
+class Microbenchmark {
+  public:
+    Microbenchmark(std::vector<Position> positions, uint rounds);
+    ~Microbenchmark();
+    void kernels();
+    // Probe tables of 2**bits entries for bits in min_bits .. max_bits
+    void tables(int min_bits, int max_bits, int step);
+
+  private:
+    // Keys used for the table probes. Needs more positions than the
+    // biggest table has cache lines, or it would be served from cache
+    static size_t const NR_KEYS = 1 << 20;
+
+    template <class Fun>
+    void time(char const* name, std::string const& what, size_t nr_ops, Fun fun);
+    template <class Table>
+    void probe(char const* name, int bits);
+
+    std::vector<Position> positions_;
+    std::vector<Bitmap> opponent_win_;
+    std::vector<Bitmap> keys_;
+    uint rounds_;
+    Bitmap sink_ = 0;
+};
+
+Microbenchmark::Microbenchmark(std::vector<Position> positions, uint rounds) :
+    positions_{std::move(positions)},
+    rounds_{rounds} {
+    if (positions_.empty()) throw_logic("No positions");
+    for (auto const& pos: positions_)
+        opponent_win_.emplace_back(pos._winning_bits(pos.color_));
+
+    // Grow the corpus ply by ply until there are enough distinct keys
+    std::vector<Position> layer = positions_;
+    for (auto const& pos: layer) keys_.emplace_back(pos.key());
+    while (keys_.size() < NR_KEYS && !layer.empty()) {
+        std::vector<Position> next;
+        for (auto const& pos: layer)
+            for (int x=0; x<WIDTH && keys_.size() < NR_KEYS; ++x)
+                if (pos.playable(x)) {
+                    auto child = pos.play(x);
+                    if (child.won()) continue;
+                    next.emplace_back(child);
+                    keys_.emplace_back(child.key());
+                }
+        layer = std::move(next);
+    }
+    std::cout << positions_.size() << " positions, " << keys_.size() << " keys for table probes" << std::endl;
+}
+
+Microbenchmark::~Microbenchmark() {}
+
+template <class Fun>
+void Microbenchmark::time(char const* name, std::string const& what,
+                          size_t nr_ops, Fun fun) {
+    double best = 0;
+    for (uint round = 0; round < rounds_; ++round) {
+        auto start = std::chrono::steady_clock::now();
+        fun();
+        auto end = std::chrono::steady_clock::now();
+        double ns = std::chrono::duration<double, std::nano>(end - start).count();
+        if (round == 0 || ns < best) best = ns;
+    }
+    char buffer[100];
+    snprintf(buffer, sizeof(buffer), "%-26s %-10s %8.3f ns/op",
+             name, what.c_str(), best / nr_ops);
+    std::cout << buffer << std::endl;
+}
+
+void Microbenchmark::kernels() {
+    size_t n = positions_.size();
+    // One corpus pass is too short to time reliably
+    size_t passes = std::max<size_t>(1, (1 << 20) / n);
+    size_t nr_ops = n * passes;
+    Position const* positions = positions_.data();
+    Bitmap const* opponent_win = opponent_win_.data();
+
+    time("_won", "", nr_ops, [&]() {
+        for (size_t p=0; p<passes; ++p)
+            for (size_t i=0; i<n; ++i) {
+                bool won = Position::_won(positions[i].color_ ^ positions[i].mask_);
+                opaque(won);
+                sink_ += won;
+            }
+    });
+    time("_winning_bits", "", nr_ops, [&]() {
+        for (size_t p=0; p<passes; ++p)
+            for (size_t i=0; i<n; ++i) {
+                auto const& pos = positions[i];
+                Bitmap bits = pos._winning_bits(pos.color_ ^ pos.mask_);
+                opaque(bits);
+                sink_ ^= bits;
+            }
+    });
+    time("_indifferent_bits", "", nr_ops, [&]() {
+        for (size_t p=0; p<passes; ++p)
+            for (size_t i=0; i<n; ++i) {
+                Bitmap bits = Position::_indifferent_bits(positions[i].color_);
+                opaque(bits);
+                sink_ ^= bits;
+            }
+    });
+    time("possible_bits", "", nr_ops, [&]() {
+        for (size_t p=0; p<passes; ++p)
+            for (size_t i=0; i<n; ++i) {
+                Bitmap bits = positions[i].possible_bits();
+                opaque(bits);
+                sink_ ^= bits;
+            }
+    });
+    time("_allowed_bits", "", nr_ops, [&]() {
+        for (size_t p=0; p<passes; ++p)
+            for (size_t i=0; i<n; ++i) {
+                Bitmap bits = Position::_allowed_bits(opponent_win[i]);
+                opaque(bits);
+                sink_ ^= bits;
+            }
+    });
+    time("_order_moves", "", nr_ops, [&]() {
+        std::array<Position::MoveEntry, WIDTH+1> order;
+        std::array<int, WIDTH+1> index;
+        index[0] = 0;
+        order[0].nr_threats = INT_MAX;
+        for (size_t p=0; p<passes; ++p)
+            for (size_t i=0; i<n; ++i) {
+                auto const& pos = positions[i];
+                // Same move filter as _alphabeta
+                Bitmap possible = pos.possible_bits() & ~(opponent_win[i] >> 1);
+                int end = pos._order_moves<ThreatOrdering>(possible, opponent_win[i],
+                                           order.data(), index.data(), 1);
+                opaque(end);
+                sink_ += end + index[1];
+            }
+    });
+}
+
+template <class Table>
+void Microbenchmark::probe(char const* name, int bits) {
+    Table table{static_cast<size_t>(1) << bits};
+    // Touch all pages before timing
+    table.clear();
+    std::string what = std::to_string(table.bytes() >> 10) + "KiB";
+    size_t n = keys_.size();
+    Bitmap const* keys = keys_.data();
+
+    time((std::string{name} + " set").c_str(), what, n, [&]() {
+        for (size_t i=0; i<n; ++i) {
+            Bitmap key = keys[i];
+            table.entry(key)->set(key, static_cast<int>(key % (2*MAX_SCORE+1)) - MAX_SCORE, key % WIDTH);
+        }
+    });
+    time((std::string{name} + " get").c_str(), what, n, [&]() {
+        for (size_t i=0; i<n; ++i) {
+            int score, best;
+            bool found = table.entry(keys[i])->get(keys[i], score, best);
+            opaque(found);
+            sink_ += found;
+        }
+    });
+    // The way _alphabeta uses it: prefetch, some work, then get
+    time((std::string{name} + " prefetch").c_str(), what, n, [&]() {
+        static int const AHEAD = 8;
+        for (size_t i=0; i<n; ++i) {
+            if (i + AHEAD < n) Table::prefetch(table.entry(keys[i+AHEAD]));
+            int score, best;
+            bool found = table.entry(keys[i])->get(keys[i], score, best);
+            opaque(found);
+            sink_ += found;
+        }
+    });
+}
+
+void Microbenchmark::tables(int min_bits, int max_bits, int step) {
+    for (int bits = min_bits; bits <= max_bits; bits += step) {
+        probe<Transposition>("Transposition", bits);
+        // Fewer slots can't hold the check bits
+        if (bits >= WDLTransposition::MIN_BITS)
+            probe<WDLTransposition>("WDLTransposition", bits);
+    }
+    // Keep the compiler from dropping the work
+    opaque(sink_);
+}
+
+namespace {
+
+// Lines starting with a move string (test files and books)
+void read_positions(std::string const& file, std::vector<Position>& positions) {
+    std::ifstream in;
+    in.exceptions(std::ifstream::badbit);
+    in.open(file);
+    if (!in) throw_errno("Could not open '" + file + "'");
+    std::string line;
+    while (getline(in, line)) {
+        std::istringstream fields{line};
+        std::string moves;
+        if (!(fields >> moves)) continue;
+        if (moves.find_first_not_of("1234567") != std::string::npos) continue;
+        try {
+            Position pos{moves};
+            if (!pos.won()) positions.emplace_back(pos);
+        } catch (std::exception&) {
+            // Not a move string after all
+        }
+    }
+}
+
+}
+
+int main([[maybe_unused]] int argc,
+         char const* const* argv) {
+    init_system();
+
+    int max_bits = 24;
+    uint rounds = 5;
+    int cpu = -1;
+
+    GetOpt options{"c:r:T:", argv};
+    long long tmp;
+    while (options.next())
+        switch (options.option()) {
+            case 'c':
+              tmp = atoll(options.arg());
+              if (tmp < 0 || tmp >= CPU_SETSIZE) throw(std::range_error("Invalid cpu"));
+              cpu = tmp;
+              break;
+            case 'r':
+              tmp = atoll(options.arg());
+              if (tmp <= 0) throw(std::range_error("rounds must be positive"));
+              rounds = tmp;
+              break;
+            case 'T':
+              tmp = atoll(options.arg());
+              if (tmp < 9 || tmp >= static_cast<int>(sizeof(size_t) * CHAR_BIT))
+                  throw(std::range_error("Invalid transposition_bits"));
+              max_bits = tmp;
+              break;
+            default:
+              std::cerr << "usage: " << argv[0] << " [-c cpu] [-r rounds] [-T max_transposition_bits] files..." << std::endl;
+              exit(EXIT_FAILURE);
+        }
+    std::vector<Position> positions;
+    for (int i = options.ind(); argv[i]; ++i) read_positions(argv[i], positions);
+
+    if (cpu >= 0) {
+        cpu_set_t cs;
+        CPU_ZERO(&cs);
+        CPU_SET(cpu, &cs);
+        if (sched_setaffinity(0, sizeof(cs), &cs))
+            throw_errno("Could not pin to cpu " + std::to_string(cpu));
+    }
+
+    Microbenchmark bench{std::move(positions), rounds};
+    bench.kernels();
+    // 4KiB (L1) up to DRAM in steps of 8
+    bench.tables(9, max_bits, 3);
+    return 0;
+}
@@ -0,0 +1,108 @@
+#include <cerrno>
+#include <cstdio>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "perf.hpp"
+
+char const* const PerfCounters::NAMES[NR_EVENTS] = {
+    "cycles", "instructions", "llc-misses", "dtlb-misses", "branch-misses",
+};
+
+namespace {
+
+uint64_t cache_miss(uint64_t cache) {
+    return cache |
+        PERF_COUNT_HW_CACHE_OP_READ << 8 |
+        PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+}
+
+struct EventType {
+    uint32_t type;
+    uint64_t config;
+};
+
+EventType const EVENT_TYPES[PerfCounters::NR_EVENTS] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_LL) },
+    { PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_DTLB) },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+}
+
+PerfCounters::PerfCounters() {
+    for (int i=0; i<NR_EVENTS; ++i) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size           = sizeof(attr);
+        attr.type           = EVENT_TYPES[i].type;
+        attr.config         = EVENT_TYPES[i].config;
+        attr.disabled       = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv     = 1;
+        attr.read_format    =
+            PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        fds_[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (fds_[i] < 0 && error_.empty())
+            error_ = std::string{NAMES[i]} + ": " + strerror(errno);
+    }
+}
+
+PerfCounters::~PerfCounters() {
+    for (auto fd: fds_)
+        if (fd >= 0) close(fd);
+}
+
+bool PerfCounters::any() const {
+    for (int i=0; i<NR_EVENTS; ++i)
+        if (available(i)) return true;
+    return false;
+}
+
+void PerfCounters::start() {
+    for (auto fd: fds_) {
+        if (fd < 0) continue;
+        if (ioctl(fd, PERF_EVENT_IOC_RESET, 0))
+            throw_errno("Could not reset performance counter");
+        if (ioctl(fd, PERF_EVENT_IOC_ENABLE, 0))
+            throw_errno("Could not enable performance counter");
+    }
+}
+
+PerfCounters::Counts PerfCounters::stop() {
+    Counts counts;
+    for (int i=0; i<NR_EVENTS; ++i) {
+        counts[i] = 0;
+        int fd = fds_[i];
+        if (fd < 0) continue;
+        if (ioctl(fd, PERF_EVENT_IOC_DISABLE, 0))
+            throw_errno("Could not disable performance counter");
+        // value, time enabled, time running
+        uint64_t values[3];
+        ssize_t got = read(fd, values, sizeof(values));
+        if (got < 0) throw_errno("Could not read performance counter");
+        if (got != sizeof(values))
+            throw_logic("Short read from performance counter");
+        if (values[2])
+            counts[i] = static_cast<double>(values[0]) * values[1] / values[2];
+    }
+    return counts;
+}
+
+std::string PerfCounters::format(Counts const& counts, uint64_t visits) const {
+    std::string out;
+    for (int i=0; i<NR_EVENTS; ++i) {
+        if (!available(i)) continue;
+        char buffer[100];
+        snprintf(buffer, sizeof(buffer), "%s%s %.0f (%.2f/visit)",
+                 out.empty() ? "" : ", ", NAMES[i], counts[i],
+                 visits ? counts[i] / visits : 0.);
+        out += buffer;
+    }
+    return out;
+}
@@ -0,0 +1,47 @@
+#ifndef perf_hpp
+# define perf_hpp 1
+
+#include <array>
+#include <string>
+
+#include "system.hpp"
+
+// Hardware performance counters (perf_event_open) of the calling thread
+// (so the work of pool threads is not included). Counters the kernel or
+// the hardware refuses (perf_event_paranoid, virtual machines) are left out
+class PerfCounters {
+  public:
+    enum Event {
+        CYCLES,
+        INSTRUCTIONS,
+        LLC_MISSES,
+        DTLB_MISSES,
+        BRANCH_MISSES,
+        NR_EVENTS,
+    };
+    // Corrected for the time a counter was not scheduled (multiplexing)
+    typedef std::array<double, NR_EVENTS> Counts;
+    static char const* const NAMES[NR_EVENTS];
+
+    PerfCounters();
+    ~PerfCounters();
+    PerfCounters(PerfCounters const&) = delete;
+    PerfCounters& operator=(PerfCounters const&) = delete;
+
+    bool available(int event) const { return fds_[event] >= 0; }
+    bool any() const;
+    // Why the first missing counter could not be opened
+    std::string const& error() const { return error_; }
+    // Zero and enable all counters
+    void start();
+    // Disable all counters and return their values
+    Counts stop();
+    // "name count (per visit), ..." for the available counters
+    std::string format(Counts const& counts, uint64_t visits) const;
+
+  private:
+    std::array<int, NR_EVENTS> fds_;
+    std::string error_;
+};
+
+#endif /* perf_hpp */
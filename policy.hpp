@@ -0,0 +1,114 @@
+#ifndef policy_hpp
+# define policy_hpp 1
+
+#include "position.hpp"
+#include "statistics.hpp"
+
+// The search is a template over a policy, a set of small static
+// functions for the parts that are worth experimenting with. Every policy
+// in the registry (Position::policy()) gets its own fully inlined copy of
+// _alphabeta, the choice between them is only made once per null window
+// probe. The transposition table is part of the policy as well, so the
+// -wdl entries of the registry differ only in using WDLTransposition
+
+// Move ordering. rank() turns the winning bits a move creates (restricted
+// to where the opponent allows them) into a rank, higher is searched first.
+// Equal ranks keep the center first order. feature() tells the statistics
+// what a rank was based on
+struct ThreatOrdering {
+    // Stacked threats get a bonus
+    ALWAYS_INLINE
+    static int rank(Bitmap allowed_winning_bits) {
+        return 2*popcount(allowed_winning_bits)+((allowed_winning_bits & allowed_winning_bits >> 1) != 0);
+    }
+    static Statistics::Feature feature(int rank) {
+        return rank & 1 ? Statistics::STACKED : rank ? Statistics::THREATS : Statistics::CENTER;
+    }
+};
+
+struct ThreatCountOrdering {
+    ALWAYS_INLINE
+    static int rank(Bitmap allowed_winning_bits) {
+        return popcount(allowed_winning_bits);
+    }
+    static Statistics::Feature feature(int rank) {
+        return rank ? Statistics::THREATS : Statistics::CENTER;
+    }
+};
+
+struct CenterOrdering {
+    ALWAYS_INLINE
+    static int rank(Bitmap) { return 0; }
+    static Statistics::Feature feature(int) { return Statistics::CENTER; }
+};
+
+// Forced move handling. Restricts possible to the moves that don't lose
+// immediately and returns false if there are none. _alphabeta relies on
+// never being called in a position that is won for the side to move,
+// so any replacement must still remove every losing move
+struct BlockForced {
+    ALWAYS_INLINE
+    static bool filter(Bitmap& possible, Bitmap opponent_win, int ply) {
+        // If any of these places is possible the opponent will play there
+        // if given a chance. To prevent that we must play there ourselves
+        // (we can't just win instead since _alphabeta is never called in
+        // a winning position)
+        auto forced_moves = opponent_win & possible;
+        if (forced_moves) {
+            if (forced_moves & (forced_moves -1)) {
+                // More than one forced move. We lose on the next move
+                Statistics::count(Statistics::DOUBLE_THREATS, ply);
+                return false;
+            }
+            // Only one forced move. We must play it
+            Statistics::count(Statistics::FORCED, ply);
+            possible = forced_moves;
+        }
+        // Avoid playing just below a winning move for the opponent
+        possible &= ~(opponent_win >> 1);
+        // (draws were already excluded so there ARE moves if this fails)
+        return possible != 0;
+    }
+};
+
+// Window narrowing. The null window probe to do next when the score is
+// known to be in [min, max] (min < max). The score is compared to med
+struct HalvingNarrowing {
+    // Bias towards 0 where most scores are
+    static int median(int min, int max) {
+        int med = min + (max - min)/2;
+        if (     med <= 0 && min/2 < med) med = min/2;
+        else if (med >= 0 && max/2 > med) med = max/2;
+        return med;
+    }
+};
+
+struct ZeroNarrowing {
+    static int median(int min, int max) {
+        int med = min + (max - min)/2;
+        if (     med <= 0 && min/2 < 0) med = min/2;
+        else if (med >= 0 && max/2 > 0) med = max/2;
+        if (med+1 > max) med = max-1;
+        if (med < min) med = min;
+        return med;
+    }
+};
+
+struct BisectNarrowing {
+    static int median(int min, int max) {
+        return min + (max - min)/2;
+    }
+};
+
+template <class OrderingT, class ForcedT, class NarrowingT,
+          class TableT = Transposition>
+struct SearchPolicy {
+    typedef OrderingT  Ordering;
+    typedef ForcedT    Forced;
+    typedef NarrowingT Narrowing;
+    typedef TableT     Table;
+};
+
+typedef SearchPolicy<ThreatOrdering, BlockForced, HalvingNarrowing> DefaultPolicy;
+
+#endif /* policy_hpp */
@@ -0,0 +1,78 @@
+#include "pool.hpp"
+#include "system.hpp"
+
+TaskPool::TaskPool(size_t nr_tasks, uint nr_threads, Task task):
+    task_{task} {
+    if (nr_threads == 0) nr_threads = NR_CPU;
+    if (nr_threads > nr_tasks) nr_threads = nr_tasks;
+    if (nr_threads == 0) return;
+    for (uint i=0; i<nr_threads; ++i) {
+        queues_.emplace_back(new Queue);
+        queues_.back()->begin = nr_tasks *  i    / nr_threads;
+        queues_.back()->end   = nr_tasks * (i+1) / nr_threads;
+    }
+    for (uint i=0; i<nr_threads; ++i)
+        threads_.emplace_back(&TaskPool::work, this, i);
+}
+
+TaskPool::~TaskPool() {
+    _join();
+}
+
+void TaskPool::_join() {
+    for (auto& thread: threads_) thread.join();
+    threads_.clear();
+}
+
+void TaskPool::join() {
+    _join();
+    if (error_) {
+        auto error = error_;
+        error_ = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+bool TaskPool::pop(uint id, size_t& task) {
+    if (failed_.load(std::memory_order_relaxed)) return false;
+    auto& queue = *queues_[id];
+    std::lock_guard<std::mutex> lock{queue.mutex};
+    if (queue.begin >= queue.end) return false;
+    task = queue.begin++;
+    return true;
+}
+
+bool TaskPool::steal(uint id) {
+    if (failed_.load(std::memory_order_relaxed)) return false;
+    uint n = queues_.size();
+    for (uint i=1; i<n; ++i) {
+        auto& victim = *queues_[(id+i) % n];
+        size_t begin, end;
+        {
+            std::lock_guard<std::mutex> lock{victim.mutex};
+            if (victim.begin >= victim.end) continue;
+            end   = victim.end;
+            begin = victim.end - (victim.end - victim.begin + 1) / 2;
+            victim.end = begin;
+        }
+        auto& queue = *queues_[id];
+        std::lock_guard<std::mutex> lock{queue.mutex};
+        queue.begin = begin;
+        queue.end   = end;
+        return true;
+    }
+    return false;
+}
+
+void TaskPool::work(uint id) {
+    size_t task;
+    try {
+        do {
+            while (pop(id, task)) task_(task, id);
+        } while (steal(id));
+    } catch (...) {
+        std::lock_guard<std::mutex> lock{error_mutex_};
+        if (!error_) error_ = std::current_exception();
+        failed_ = true;
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef pool_hpp
+# define pool_hpp 1
+
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "constants.hpp"
+
+// Work stealing thread pool running task(0) .. task(nr_tasks-1).
+// Tasks also get the number of the worker running them (0 .. threads-1).
+// Each worker starts with a contiguous block of task numbers which it
+// runs in order. A worker that runs out steals the last half of the
+// block of another worker. Contiguous blocks keep related tasks (like
+// the positions of a subtree) on one thread. If a task throws, no new
+// tasks are started and join() rethrows the first exception
+class TaskPool {
+  public:
+    typedef std::function<void(size_t task, uint worker)> Task;
+
+    // nr_threads 0 means one per CPU
+    TaskPool(size_t nr_tasks, uint nr_threads, Task task);
+    // Doesn't rethrow, call join() to get a task exception
+    ~TaskPool();
+    void join();
+    uint nr_threads() const { return queues_.size(); }
+
+  private:
+    struct Queue {
+        std::mutex mutex;
+        size_t begin, end;
+    };
+
+    void _join();
+    void work(uint id);
+    bool pop(uint id, size_t& task);
+    bool steal(uint id);
+
+    Task const task_;
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> threads_;
+    std::atomic<bool> failed_{false};
+    std::mutex error_mutex_;
+    std::exception_ptr error_;
+};
+
+#endif /* pool_hpp */
@@ -1,17 +1,42 @@
 #include <array>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "position.hpp"
+#include "endgame.hpp"
+#include "policy.hpp"
+#include "statistics.hpp"
+#include "pool.hpp"
 
 bool const DEBUG = false;
 // BEST true doesn't work currently
 bool const BEST  = false;
 
-int Position::start_depth_;
-uint64_t Position::nr_visits_;
-uint64_t Position::hits_;
-uint64_t Position::misses_;
+thread_local int Position::start_depth_;
+thread_local uint64_t Position::nr_visits_;
+thread_local uint64_t Position::hits_;
+thread_local uint64_t Position::misses_;
 
 Transposition Position::transpositions_;
+WDLTransposition Position::wdl_transpositions_;
+bool Position::wdl_ = false;
+
+std::atomic<Position::Clock::rep> Position::deadline_{Position::Clock::time_point::max().time_since_epoch().count()};
+std::atomic<bool> Position::interrupt_{false};
+uint64_t Position::visit_budget_ = UINT64_MAX;
+Endgame const* Position::endgame_ = nullptr;
+int Position::endgame_plies_ = -1;
 
 std::array<Bitmap, WIDTH> const Position::move_order_ = Position::generate_move_order();
 
@@ -72,9 +97,42 @@ void to_board(Bitmap bitmap, char* buf, int indent) {
     *buf = 0;
 }
 
-Transposition::Transposition(size_t size): entries_{size} {}
+char const Transposition::MAGIC[8] = {'C', '4', 'T', 'A', 'B', 'L', 'E', '1'};
+
+Transposition::Transposition(size_t size) {
+    resize(size);
+}
+
+// Shared and file tables start with a header
+void Transposition::map(size_t size, int fd) {
+    void* map = fd < 0 ?
+        mmap(nullptr, size * sizeof(value_type), PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) :
+        mmap(nullptr, HEADER_BYTES + size * sizeof(value_type), PROT_READ | PROT_WRITE,
+             MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) throw_errno("Could not map transposition table");
+    if (fd < 0) {
+        header_  = nullptr;
+        entries_ = static_cast<value_type*>(map);
+    } else {
+        header_  = static_cast<Header*>(map);
+        entries_ = reinterpret_cast<value_type*>(static_cast<char*>(map) + HEADER_BYTES);
+    }
+    size_    = size;
+    bits_    = ALL_BITS-first_bit(size);
+}
+
+void Transposition::unmap() {
+    if (header_) munmap(header_, HEADER_BYTES + bytes());
+    else if (entries_) munmap(entries_, bytes());
+    header_  = nullptr;
+    entries_ = nullptr;
+    size_    = 0;
+    shared_  = false;
+}
 
 void Transposition::resize(size_t size) {
+    unmap();
     if (size) {
         uint bits = first_bit(size);
         size_t real_size = static_cast<size_t>(1) << bits;
@@ -84,151 +142,276 @@ void Transposition::resize(size_t size) {
                 throw_logic("Size is way too high");
             real_size *= 2;
         }
-        entries_.resize(real_size);
-        bits_ = ALL_BITS-bits;
+        map(real_size, -1);
+    }
+}
+
+void Transposition::rehash(size_t size) {
+    if (shared_) throw_logic("Cannot resize a shared table");
+    if (!entries_) throw_logic("Attempt to rehash without memory");
+    if (!size || (size & (size-1))) throw_logic("Table size must be a power of 2");
+    if (size == size_) return;
+    size_t old_size = size_;
+    auto move = [this](size_t i) {
+        Bitmap value = entries_[i].value_;
+        entries_[i].value_ = 0;
+        Bitmap key = value & KEY_MASK;
+        // Empty or the empty board, which is never stored
+        if (key == 0 || value == value_type::INVALID().value_) return;
+        entries_[fast_hash(key)].value_ = value;
+    };
+    if (size > old_size) {
+        void* map = mremap(entries_, bytes(), size * sizeof(value_type), MREMAP_MAYMOVE);
+        if (map == MAP_FAILED) throw_errno("Could not grow transposition table");
+        entries_ = static_cast<value_type*>(map);
+        size_    = size;
+        bits_    = ALL_BITS-first_bit(size);
+        // Entry i moves to a slot >= i * (size/old_size) > i, which has
+        // already been emptied, so go down
+        for (size_t i = old_size; i-- > 0;) move(i);
+    } else {
+        bits_ = ALL_BITS-first_bit(size);
+        // Entry i moves to slot i / (old_size/size) <= i, so go up
+        for (size_t i = 0; i < old_size; ++i) move(i);
+        void* map = mremap(entries_, bytes(), size * sizeof(value_type), 0);
+        if (map == MAP_FAILED) throw_errno("Could not shrink transposition table");
+        size_ = size;
+    }
+    *entry(0) = value_type::INVALID();
+}
+
+void Transposition::share(std::string const& name, size_t size) {
+    unmap();
+    if (!size || (size & (size-1)))
+        throw_logic("Shared table size must be a power of 2");
+    std::string path = "/" + name;
+    std::string what = "shared memory '" + name + "'";
+    bool created = true;
+    int fd = shm_open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 && errno == EEXIST) {
+        created = false;
+        fd = shm_open(path.c_str(), O_RDWR, 0);
+    }
+    if (fd < 0) throw_errno("Could not open " + what);
+    if (!created) {
+        // The creator may not have sized or initialized it yet. If it died
+        // doing that the segment is never going to be ready
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(SHARE_TIMEOUT);
+        Header header;
+        try {
+            while (!read_header(fd, header, what) || !header.ready) {
+                if (std::chrono::steady_clock::now() >= deadline)
+                    throw_logic(what + " was not initialized within " + std::to_string(SHARE_TIMEOUT) + " seconds. If its creator died remove /dev/shm" + path);
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        } catch (...) {
+            close(fd);
+            throw;
+        }
+    }
+    attach(fd, created, size, what);
+}
+
+bool Transposition::map_file(std::string const& file, size_t size, bool keep) {
+    unmap();
+    if (!size || (size & (size-1)))
+        throw_logic("Table size must be a power of 2");
+    int fd = open(file.c_str(), O_RDWR | O_CREAT | (keep ? 0 : O_TRUNC), 0666);
+    if (fd < 0) throw_errno("Could not open '" + file + "'");
+    struct stat st;
+    if (fstat(fd, &st)) {
+        int err = errno;
+        close(fd);
+        throw_errno(err, "Could not stat '" + file + "'");
+    }
+    bool created = st.st_size == 0;
+    if (!created) {
+        // A run that died while creating the file never finished it
+        Header header;
+        try {
+            if (!read_header(fd, header, "'" + file + "'") || !header.ready) {
+                if (ftruncate(fd, 0))
+                    throw_errno("Could not truncate '" + file + "'");
+                created = true;
+            }
+        } catch (...) {
+            close(fd);
+            throw;
+        }
+    }
+    attach(fd, created, size, "'" + file + "'");
+    return !created;
+}
+
+bool Transposition::read_header(int fd, Header& header, std::string const& what) {
+    ssize_t got = pread(fd, &header, sizeof(header), 0);
+    if (got < 0) throw_errno("Could not read " + what);
+    return static_cast<size_t>(got) == sizeof(header);
+}
+
+// Map table memory fd (and close it). If created it gets size entries,
+// otherwise the size is taken from its header, which must match this build
+void Transposition::attach(int fd, bool created, size_t size,
+                           std::string const& what) {
+    try {
+        if (created) {
+            if (ftruncate(fd, HEADER_BYTES + size * sizeof(value_type)))
+                throw_errno("Could not size " + what);
+        } else {
+            Header header;
+            struct stat st;
+            if (!read_header(fd, header, what) ||
+                std::memcmp(header.magic, MAGIC, sizeof(MAGIC)))
+                throw_logic(what + " is not a transposition table");
+            if (header.width != WIDTH || header.height != HEIGHT ||
+                header.entry_bytes != sizeof(value_type) ||
+                header.key_bits != KEY_BITS)
+                throw_logic(what + " is a table for another build (" +
+                            std::to_string(header.width) + "x" + std::to_string(header.height) + " board, " +
+                            std::to_string(header.entry_bytes) + " byte entries with " +
+                            std::to_string(header.key_bits) + " key bits)");
+            size = header.size;
+            if (fstat(fd, &st))
+                throw_errno("Could not stat " + what);
+            if (!size || (size & (size-1)) ||
+                HEADER_BYTES + size * sizeof(value_type) != static_cast<size_t>(st.st_size))
+                throw_logic(what + " has a corrupt header");
+        }
+        map(size, fd);
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    close(fd);
+    shared_ = true;
+    if (created) {
+        // New memory is all zeros, which would be a hit for the empty board
+        __atomic_store_n(&entry(0)->value_, value_type::INVALID().value_, __ATOMIC_RELAXED);
+        std::memcpy(header_->magic, MAGIC, sizeof(MAGIC));
+        header_->width       = WIDTH;
+        header_->height      = HEIGHT;
+        header_->entry_bytes = sizeof(value_type);
+        header_->key_bits    = KEY_BITS;
+        header_->size        = size;
+        __atomic_store_n(&header_->ready, 1, __ATOMIC_RELEASE);
+        // flush() only covers entries, so a table file can be trusted later
+        if (msync(header_, HEADER_BYTES, MS_SYNC))
+            throw_errno("Could not flush the header of " + what);
+    }
+}
+
+void Transposition::flush(size_t begin, size_t end, bool wait) {
+    if (!shared_) return;
+    // msync wants page aligned addresses
+    size_t page = sysconf(_SC_PAGESIZE);
+    auto from = reinterpret_cast<uintptr_t>(entries_ + begin) & ~(page-1);
+    auto to   = reinterpret_cast<uintptr_t>(entries_ + std::min(end, size_));
+    if (to <= from) return;
+    if (msync(reinterpret_cast<void*>(from), to - from, wait ? MS_SYNC : MS_ASYNC))
+        throw_errno("Could not flush transposition table");
+}
+
+WDLTransposition::WDLTransposition(size_t size) {
+    resize(size);
+}
+
+void WDLTransposition::resize(size_t size) {
+    if (size) {
+        int bits = first_bit(size);
+        // Fewer slots would need more check bits than there is space for
+        if (bits < MIN_BITS) bits = MIN_BITS;
+        if (bits > KEY_BITS) bits = KEY_BITS;
+        entries_.resize(static_cast<size_t>(1) << bits);
+        bits_ = bits;
     } else
         entries_.clear();
 }
 
-void Transposition::clear() {
+void WDLTransposition::rehash(size_t size) {
+    if (entries_.empty()) throw_logic("Attempt to rehash without memory");
+    int bits = first_bit(size);
+    if (bits < MIN_BITS) bits = MIN_BITS;
+    if (bits > KEY_BITS) bits = KEY_BITS;
+    if (bits == bits_) return;
+    // The slot number and the check bits together give back the hash
+    std::vector<value_type> entries(static_cast<size_t>(1) << bits);
+    for (size_t i=0; i<entries_.size(); ++i) {
+        uint32_t value = entries_[i].value_;
+        if ((value & value_type::RESULT_MASK) == value_type::EMPTY) continue;
+        Bitmap hash = static_cast<Bitmap>(i) << (KEY_BITS-bits_) | value >> RESULT_BITS;
+        int score = (value & value_type::RESULT_MASK) == value_type::LOSS ? -1 : 0;
+        entries[hash >> (KEY_BITS-bits)].set(hash, bits, score);
+    }
+    entries_.swap(entries);
+    bits_ = bits;
+}
+
+void WDLTransposition::clear() {
     if (entries_.empty()) throw_logic("Attempt to clear without memory");
     std::memset(reinterpret_cast<void *>(&entries_[0]), 0, entries_.size() * sizeof(entries_[0]));
-    // Make sure the empty board is not a hit
-    *entry(0) = value_type::INVALID();
 }
 
-//FLATTEN
-//std::ostream& operator<<(std::ostream& os, Bitmap bitmap) {
-//    os << to_bits(bitmap);
-//    return os;
-//}
+void Position::init_shared(std::string const& name, size_t size) {
+    if (wdl_) throw_logic("The win/draw/loss table can't be shared");
+    transpositions_.share(name, size);
+}
 
-bool Position::_won(Bitmap pos) {
-    // horizontal
-    Bitmap m = pos & (pos >> USED_HEIGHT);
-    if (m & (m >> 2*USED_HEIGHT)) return true;
+void Position::resize(size_t size) {
+    if (wdl_)
+        wdl_transpositions_.rehash(size * sizeof(Transposition::value_type) / sizeof(WDLTransposition::value_type));
+    else
+        transpositions_.rehash(size);
+}
 
-    // diagonal 1
-    m = pos & (pos >> (USED_HEIGHT-1));
-    if (m & (m >> 2*(USED_HEIGHT-1))) return true;
+bool Position::init_file(std::string const& file, size_t size, bool keep) {
+    if (wdl_) throw_logic("The win/draw/loss table can't be kept in a file");
+    return transpositions_.map_file(file, size, keep);
+}
 
-    // diagonal 2
-    m = pos & (pos >> (USED_HEIGHT+1));
-    if (m & (m >> 2*(USED_HEIGHT+1))) return true;
+void Position::init(size_t size) {
+    if (wdl_) {
+        transpositions_.resize(0);
+        wdl_transpositions_.resize(size * sizeof(Transposition::value_type) / sizeof(WDLTransposition::value_type));
+    } else {
+        wdl_transpositions_.resize(0);
+        transpositions_.resize(size);
+    }
+}
 
-    // vertical;
-    m = pos & (pos >> 1);
-    if (m & (m >> 2)) return true;
+template <>
+Transposition& Position::_transpositions<Transposition>() {
+    return transpositions_;
+}
 
-    return false;
+template <>
+WDLTransposition& Position::_transpositions<WDLTransposition>() {
+    return wdl_transpositions_;
 }
 
-ALWAYS_INLINE
-Bitmap _indifferent_bits(Bitmap color) {
-    Bitmap r = 0;
-    Bitmap p;
-
-    // vertical
-    p = (color << 1) & (color << 2);
-    // p = 2 stones next to each other (shifted one row up)
-    // Check  Xxx?
-    r |= p & (color << 3);
-    // Check xx?X
-    r |= p & (color >> 1);
-    // p = 2 stones next to each other (shifted one row down)
-    // We can get this from the previous p. Left for now for symmetry
-    //    .xx. => x...
-    p = (color >> 1) & (color >> 2);
-    // Check X?xx
-    r |= p & (color << 1);
-    // Check ?xxX
-    r |= p & (color >> 3);
-
-    // horizontal
-    // p = 2 stones next to each other (shifted one column to the right)
-    //    .xx. => ...x
-    p = (color << USED_HEIGHT) & (color << 2*USED_HEIGHT);
-    // Check  Xxx?
-    r |= p & (color << 3*USED_HEIGHT);
-    // Check xx?X
-    r |= p & (color >> USED_HEIGHT);
-    // p = 2 stones next to each other (shifted one column to the left)
-    // Cannot get this from previous p unless we know top was not shifted out
-    //    .xx. => x...
-    p = (color >> USED_HEIGHT) & (color >> 2*USED_HEIGHT);
-    // Check X?xx
-    r |= p & (color << USED_HEIGHT);
-    // Check ?xxX
-    r |= p & (color >> 3*USED_HEIGHT);
-
-    // diagonals are simular but moving columns one up/down
-    //diagonal 1
-    p = (color << HEIGHT) & (color << 2*HEIGHT);
-    r |= p & (color << 3*HEIGHT);
-    r |= p & (color >> HEIGHT);
-    p = (color >> HEIGHT) & (color >> 2*HEIGHT);
-    r |= p & (color << HEIGHT);
-    r |= p & (color >> 3*HEIGHT);
-
-    //diagonal 2
-    p = (color << (USED_HEIGHT+1)) & (color << 2*(USED_HEIGHT+1));
-    r |= p & (color << 3*(USED_HEIGHT+1));
-    r |= p & (color >> (USED_HEIGHT+1));
-    p = (color >> (USED_HEIGHT+1)) & (color >> 2*(USED_HEIGHT+1));
-    r |= p & (color << (USED_HEIGHT+1));
-    r |= p & (color >> 3*(USED_HEIGHT+1));
-
-    // All of them can mistakenly hit the guard bit(s) and already filled bits
-    // We mask these out here
-    // BOARD_MASK ^ mask = bits that are actually empty
-    return r & BOARD_MASK;
+bool Position::transposition_get(int& score) const {
+    int best;
+    if (wdl_) return wdl_transpositions_.entry(key())->get(key(), score, best);
+    return transposition_entry()->get(key(), score, best);
 }
 
-ALWAYS_INLINE
-Bitmap Position::_winning_bits(Bitmap color) const {
-    // vertical (3 stones on top of each other)
-    Bitmap r = (color << 1) & (color << 2) & (color << 3);
-
-    Bitmap p;
-    // horizontal
-    // p = 2 stones next to each other (shifted one column to the right)
-    //    .xx. => ...x
-    p = (color << USED_HEIGHT) & (color << 2*USED_HEIGHT);
-    // Check  Xxx?
-    r |= p & (color << 3*USED_HEIGHT);
-    // Check xx?X
-    r |= p & (color >> USED_HEIGHT);
-    // p = 2 stones next to each other (shifted one column to the left)
-    //    .xx. => x...
-    p = (color >> USED_HEIGHT) & (color >> 2*USED_HEIGHT);
-    // Check X?xx
-    r |= p & (color << USED_HEIGHT);
-    // Check ?xxX
-    r |= p & (color >> 3*USED_HEIGHT);
-
-    // diagonals are simular but moving columns one up/down
-    // diagonal 1
-    p = (color << HEIGHT) & (color << 2*HEIGHT);
-    r |= p & (color << 3*HEIGHT);
-    r |= p & (color >> HEIGHT);
-    p = (color >> HEIGHT) & (color >> 2*HEIGHT);
-    r |= p & (color << HEIGHT);
-    r |= p & (color >> 3*HEIGHT);
-
-    // diagonal 2
-    p = (color << (USED_HEIGHT+1)) & (color << 2*(USED_HEIGHT+1));
-    r |= p & (color << 3*(USED_HEIGHT+1));
-    r |= p & (color >> (USED_HEIGHT+1));
-    p = (color >> (USED_HEIGHT+1)) & (color >> 2*(USED_HEIGHT+1));
-    r |= p & (color << (USED_HEIGHT+1));
-    r |= p & (color >> 3*(USED_HEIGHT+1));
-
-    // All of them can mistakenly hit the guard bit(s) and already filled bits
-    // We mask these out here
-    // BOARD_MASK ^ mask = bits that are actually empty
-    return r & (BOARD_MASK ^ mask_);
+void Position::transposition_set(int score) const {
+    if (wdl_) wdl_transpositions_.entry(key())->set(key(), score, 0);
+    else transposition_entry()->set(key(), score, 0);
 }
 
+void Transposition::clear() {
+    if (!entries_) throw_logic("Attempt to clear without memory");
+    std::memset(reinterpret_cast<void *>(entries_), 0, bytes());
+    // Make sure the empty board is not a hit
+    *entry(0) = value_type::INVALID();
+}
+
+//FLATTEN
+//std::ostream& operator<<(std::ostream& os, Bitmap bitmap) {
+//    os << to_bits(bitmap);
+//    return os;
+//}
+
 ALWAYS_INLINE
 Bitmap Position::winning_bits() const {
     return _winning_bits(color_ ^ mask_);
@@ -259,6 +442,48 @@ Position Position::play(char const* ptr, size_t size) {
     return pos;
 }
 
+Position Position::from_key(Bitmap key) {
+    if (key & ~KEY_MASK) throw_logic("Key has bits above KEY_BITS");
+    // A column of all ones would carry into the next column
+    Bitmap ones = key;
+    ones &= ones >> 1;
+    ones &= ones >> 2;
+    ones &= ones >> 3;
+    if (ones & BOTTOM_BITS) throw_logic("Key has an impossible column");
+    Position pos = decode_key(key);
+    if (pos.key() != key || !pos.valid())
+        throw_logic("Key of an impossible position");
+    return pos;
+}
+
+void Position::encode(Position const* RESTRICT positions, Bitmap* RESTRICT keys, size_t n) {
+    for (size_t i=0; i<n; ++i) keys[i] = positions[i].key();
+}
+
+void Position::decode(Bitmap const* RESTRICT keys, Position* RESTRICT positions, size_t n) {
+    for (size_t i=0; i<n; ++i) positions[i] = decode_key(keys[i]);
+}
+
+bool Position::valid() const {
+    if (color_ & ~mask_) return false;
+    if (popcount(color_) != (nr_plies()+1) / 2) return false;
+    // Otherwise the game ended before the last move
+    return !_won(color_ ^ mask_);
+}
+
+Position Position::mirror() const {
+    Bitmap const COLUMN = (ONE << USED_HEIGHT) - 1;
+    Bitmap color = 0;
+    Bitmap mask  = 0;
+    for (int x=0; x<WIDTH; ++x) {
+        int from = x * USED_HEIGHT;
+        int to   = (WIDTH-1-x) * USED_HEIGHT;
+        color |= (color_ >> from & COLUMN) << to;
+        mask  |= (mask_  >> from & COLUMN) << to;
+    }
+    return Position{color, mask};
+}
+
 Position Position::play(std::istream& in) const {
     std::string line;
     Position pos = *this;
@@ -305,6 +530,20 @@ bool equal_score(int s1, int s2, int method) {
     return (s1 < 0 && s2 < 0) || (s1 == 0 && s2 == 0) || (s1 > 0 && s2 > 0);
 }
 
+// Check without searching if the position is known to score target.
+// Every reply to a position with an exact score scores at least target,
+// so a trivial score or a table upper bound can be enough to prove it
+bool Position::_proven(int target, int method) const {
+    int score;
+    if (_trivial(score)) return equal_score(score, target, method);
+    // We lose anyways, so every move is as good as any other
+    if (method && target > 0) return true;
+    if (!transposition_get(score)) return false;
+    if (!method)    return score <= target;
+    if (target < 0) return score < 0;
+    return score <= 0;
+}
+
 std::vector<int> Position::principal_variation(int score, int method) const {
     std::vector<int> moves;
     auto pos = *this;
@@ -313,13 +552,29 @@ std::vector<int> Position::principal_variation(int score, int method) const {
         auto possible = pos.possible_bits();
         if (!possible || pos.won()) break;
         // std::cout << "Analyzing target " << score << ", possible: " << to_bits(possible) << "\n" << pos;
+        // The weak methods only need the sign and a probe result above the
+        // target is only a lower bound, so probe at the edge of the sign
+        int target = !method || score > 0 ? score : score < 0 ? -1 : 0;
+        // First walk the moves the transposition table already proved
         for (auto& move: move_order_) {
             Bitmap move_bit = possible & move;
             if (!move_bit) continue;
             auto p = pos._play(move_bit);
-            auto s = p.solve(method, score);
+            if (p._proven(score, method)) {
+                int best = first_bit(move) / USED_HEIGHT;
+                moves.emplace_back(best);
+                pos = p;
+                goto FOUND;
+            }
+        }
+        // Entry got overwritten (or was never stored). Search again
+        for (auto& move: move_order_) {
+            Bitmap move_bit = possible & move;
+            if (!move_bit) continue;
+            auto p = pos._play(move_bit);
+            auto s = p.solve(method, target);
             // std::cout << "Try move " << to_bits(move_bit) << " -> " << s << "\n";
-            if (equal_score(s, score, method)) {
+            if (s <= target) {
                 int best = first_bit(move) / USED_HEIGHT;
                 moves.emplace_back(best);
                 pos = p;
@@ -333,6 +588,23 @@ std::vector<int> Position::principal_variation(int score, int method) const {
     return moves;
 }
 
+int Position::best_move(int score, int method) const {
+    auto possible = possible_bits();
+    if (!won()) {
+        score = -score;
+        for (auto& move: move_order_) {
+            Bitmap move_bit = possible & move;
+            if (move_bit && _play(move_bit)._proven(score, method))
+                return first_bit(move) / USED_HEIGHT;
+        }
+        int best = _best_known_move();
+        if (best >= 0) return best;
+    }
+    for (int x=0; x<WIDTH; ++x)
+        if (playable(x)) return x;
+    return -1;
+}
+
 int Position::negamax() const {
     // std::cout << "Consider:\n" << *this;
     visit();
@@ -366,10 +638,12 @@ int Position::negamax() const {
 // actual_score <= alpha         THEN actual score <= return value <= alpha
 // actual score  >= beta         THEN actual score >= return value >= beta
 // alpha <= actual score <= beta THEN        return value = actual score
+template <class Policy>
 int Position::_alphabeta(int alpha, int beta, Bitmap opponent_win) const {
+    typedef typename Policy::Table Table;
 
-    auto transposition = transposition_entry();
-    __builtin_prefetch(transposition);
+    auto transposition = _transpositions<Table>().entry(key());
+    Table::prefetch(transposition);
     // Avoid the prefetch being moved down
     asm("");
 
@@ -382,28 +656,20 @@ int Position::_alphabeta(int alpha, int beta, Bitmap opponent_win) const {
     }
 
     visit();
+    int ply = STATISTICS ? nr_plies() : 0;
+    Statistics::count(Statistics::VISITS, ply);
 
-    auto possible = possible_bits();
-    // If any of these places is possible the opponent will play there if given
-    // a chance. To prevent that we must play there ourselves (we can't just
-    // win instead since _alphabeta is never called in a winning position)
-    auto forced_moves = opponent_win & possible;
-    if (forced_moves) {
-        if (forced_moves & (forced_moves -1)) {
-            // More than one forced move. We lose on the next move
-            return -score2();
-        }
-        // Only one forced move. We must play it
-        possible = forced_moves;
+    int left = nr_plies_left();
+    if (UNLIKELY(left <= endgame_plies_)) {
+        int score;
+        if (endgame_->probe(key(), score)) return score;
     }
-    // Avoid playing just below a winning move for the opponent
-    possible &= ~(opponent_win >> 1);
-    if (!possible)
+
+    auto possible = possible_bits();
+    if (!Policy::Forced::filter(possible, opponent_win, ply))
         // It seems that every move loses
-        // (draws were already excluded so there ARE moves)
         return -score2();
 
-    int left = nr_plies_left();
     // No need to detect draw (in 2 moves).
     // If left = 2 then (below) min = max = 0 and we will immediately return 0
 
@@ -411,15 +677,14 @@ int Position::_alphabeta(int alpha, int beta, Bitmap opponent_win) const {
     int min = 1-left/2;
     if (alpha < min) {
         alpha = min;
-        if (alpha >= beta) return alpha;
+        if (alpha >= beta) {
+            // The result is at least the original beta
+            Statistics::count(Statistics::FAIL_HIGH, ply);
+            return alpha;
+        }
     }
 
-    struct Entry {
-        Bitmap after_move;
-        Bitmap winning_bits;
-        int nr_threats;
-    };
-    std::array<Entry, WIDTH+1> order;
+    std::array<MoveEntry, WIDTH+1> order;
     std::array<int,   WIDTH+1> index;
     int pos = 1;
     int max, best;
@@ -427,13 +692,14 @@ int Position::_alphabeta(int alpha, int beta, Bitmap opponent_win) const {
     Bitmap my_stones = color_ ^ mask_;
     if (transposition->get(key(), max, best)) {
         hit();
+        Statistics::count(Statistics::HITS, ply);
         if (DEBUG) {
             for (int i=0; i<indent; ++i) std::cout << " ";
             std::cout << "Cached score=" << max << ", best=" << best << "\n";
         }
         if (BEST) {
             best_bit = ((ONE << HEIGHT) -1) << best * USED_HEIGHT & possible;
-            order[pos++] = Entry{my_stones | best_bit, 0, INT_MAX};
+            order[pos++] = MoveEntry{my_stones | best_bit, 0, INT_MAX};
         } else {
             best_bit = 0;
             index[0] = 0;
@@ -441,6 +707,9 @@ int Position::_alphabeta(int alpha, int beta, Bitmap opponent_win) const {
         }
     } else {
         miss();
+        Statistics::count(Statistics::MISSES, ply);
+        if (STATISTICS && transposition->used())
+            Statistics::count(Statistics::COLLISIONS, ply);
         // Upperbound since we cannot win on our next move
         max = (left-1)/2;
         best_bit = 0;
@@ -452,69 +721,38 @@ int Position::_alphabeta(int alpha, int beta, Bitmap opponent_win) const {
         // We can't do better than max anyways, so lower beta
         beta = max;
         // Immediately return if the window closed
-        if (alpha >= beta) return beta;
+        if (alpha >= beta) {
+            // The result is at most the original alpha
+            Statistics::count(Statistics::FAIL_LOW, ply);
+            return beta;
+        }
     }
 
     // Explore moves
-    if (false && best_bit) {
-        // If we got a best move from the cache the ordering isn't so important
-        // It causes some more visits due to bad ordering for the rest of the
-        // moves but the speedup is still worth it
-        order[pos].after_move = my_stones | best_bit;
-        order[pos].winning_bits = _winning_bits(order[pos].after_move);
-        index[pos] = pos;
-        ++pos;
-        for (auto& move: move_order_) {
-            Bitmap move_bit = possible & move;
-            if (!move_bit || move_bit == best_bit) continue;
-            // We can actually move there
-            order[pos].after_move = my_stones | move_bit;
-            order[pos].winning_bits = _winning_bits(order[pos].after_move);
-            index[pos] = pos;
-            ++pos;
-        }
-    } else {
-        auto opponent_stacked = opponent_win & (opponent_win << 1);
-        // Convert to mask
-        auto opponent_allowed = opponent_stacked | ABOVE_BITS;
-        opponent_allowed &= ~opponent_allowed + BOTTOM_BITS;
-        opponent_allowed -= BOTTOM_BITS;
-        opponent_allowed &= BOARD_MASK;
-        // Insertion sort based on how many threats we have
-        for (int i=0; i<WIDTH; ++i) {
-            Bitmap move_bit = possible & move_order_[i];
-            if (!move_bit) continue;
-            // We can actually move there
-            Bitmap after_move = my_stones | move_bit;
-            Bitmap winning_bits = _winning_bits(after_move);
-            Bitmap allowed_winning_bits = winning_bits & opponent_allowed;
-            // Bonus for stacked winning bits
-            // int nr_threats = 4*popcount(allowed_winning_bits)+2*((allowed_winning_bits & allowed_winning_bits >> 1) != 0)+(move_bit == best_bit);
-            int nr_threats = 2*popcount(allowed_winning_bits)+((allowed_winning_bits & allowed_winning_bits >> 1) != 0);
-            order[pos] = Entry{after_move, winning_bits, nr_threats};
-            int p = pos;
-            while (nr_threats > order[index[p-1]].nr_threats) {
-                index[p] = index[p-1];
-                --p;
-            }
-            index[p] = pos++;
-        }
-    }
+    pos = _order_moves<typename Policy::Ordering>(possible, opponent_win, order.data(), index.data(), pos);
     int current = MAX_SCORE+1;
     Bitmap move = 0;
+    int const alpha_in = alpha;
     alpha = -alpha;
     beta  = -beta;
     for (int p=1; p<pos; ++p) {
         auto& entry = order[index[p]];
         auto after_move = entry.after_move;
         auto position = Position{after_move, after_move | mask_};
-        int s = position._alphabeta(beta, alpha, entry.winning_bits);
+        int s = position._alphabeta<Policy>(beta, alpha, entry.winning_bits);
         if (DEBUG) {
             for (int i=0; i<indent; ++i) std::cout << " ";
             std::cout << "Result [" << -alpha << ", " << -beta << "] = " << s << "\n";
         }
         // Prune if we find better than the window
-        if (s <= beta) return -s;
+        auto feature = STATISTICS && entry.nr_threats == INT_MAX ?
+            Statistics::TABLE : Policy::Ordering::feature(entry.nr_threats);
+        if (STATISTICS && p == 1) Statistics::first(feature);
+        if (s <= beta) {
+            Statistics::count(Statistics::FAIL_HIGH, ply);
+            Statistics::cutoff(p, feature);
+            return -s;
+        }
         // Found a value better than alpha (but worse than beta)
         // Narrow the window since we only have to do better than this latest
         if (s < current) {
@@ -524,6 +762,7 @@ int Position::_alphabeta(int alpha, int beta, Bitmap opponent_win) const {
         }
     }
     current = -current;
+    if (current <= alpha_in) Statistics::count(Statistics::FAIL_LOW, ply);
     move ^= my_stones;
     if (BEST)
         best = first_bit(move) / USED_HEIGHT;
@@ -534,18 +773,58 @@ int Position::_alphabeta(int alpha, int beta, Bitmap opponent_win) const {
     return current;
 }
 
-int Position::solve(int method, int target_score, int debug) const {
+void Position::endgame(Endgame const* endgame) {
+    endgame_       = endgame;
+    endgame_plies_ = endgame ? endgame->plies() : -1;
+}
+
+void Position::check_limits() {
+    if (interrupt_.load(std::memory_order_relaxed) ||
+        nr_visits_ >= visit_budget_ ||
+        Clock::now().time_since_epoch().count() >=
+        deadline_.load(std::memory_order_relaxed))
+        throw Interrupted{};
+}
+
+// Best move according to what the transposition table proved so far.
+// A table upper bound on the position after a move is a lower bound for
+// the move itself
+int Position::_best_known_move() const {
+    int best = -1;
+    int best_score = INT_MIN;
+    auto possible = possible_bits();
+    for (auto& move: move_order_) {
+        Bitmap move_bit = possible & move;
+        if (!move_bit) continue;
+        auto p = _play(move_bit);
+        int score;
+        if (p.won()) score = p.score();
+        else if (p.winning_bits() & p.possible_bits()) score = -p.score1();
+        else if (p.transposition_get(score)) score = -score;
+        // Not losing immediately is already something
+        else score = -p.score3();
+        if (score > best_score) {
+            best_score = score;
+            best = first_bit(move) / USED_HEIGHT;
+        }
+    }
+    return best;
+}
+
+bool Position::_trivial(int& score, int debug) const {
     // Check if opponent already won
     if (won()) {
         visit();
-        return -score();
+        score = -this->score();
+        return true;
     }
 
     // No moves at all is a draw
     auto possible = possible_bits();
     if (!possible) {
         visit();
-        return 0;
+        score = 0;
+        return true;
     }
 
     // If we can win in 1 move say we can win on the next move
@@ -553,71 +832,235 @@ int Position::solve(int method, int target_score, int debug) const {
     if (winning & possible) {
         if (debug) std::cout << "Immediate win: " << winning << " " << possible << "\n";
         visit();
-        return score1();
+        score = score1();
+        return true;
     }
 
     // Next move is not a win and there was only 1 spot left to play so draw
     if (nr_plies_left() == 1) {
         visit();
-        return 0;
+        score = 0;
+        return true;
+    }
+    return false;
+}
+
+// Initial score window for a position that doesn't finish in 1 ply
+void Position::_window(int method, int& min, int& max) const {
+    min = -score2();	// win after 2 more plies
+    max =  score3();	// win after 3 more plies
+    if (method == 1) {
+        if (min < -1) min = -1;
+        if (max >  1) max =  1;
+    }
+}
+
+// Iteratively narrow the [min, max] exploration window.
+// On success the score is in min.
+// If floor is given give up (returning false) as soon as min >= *floor
+template <class Policy>
+bool Position::_narrow_policy(int& min, int& max, int method, int debug,
+                              std::atomic<int> const* floor,
+                              Progress const* progress) const {
+    // Weak2 probes far from 0 where this table keeps nothing
+    if (std::is_same<typename Policy::Table, WDLTransposition>::value && method != 1)
+        throw_logic("The win/draw/loss table only supports the weak method");
+    int indent = INDENT * this->indent();
+    auto opponent_winning_bits = this->opponent_winning_bits();
+    while (min < max) {
+        if (floor && min >= floor->load(std::memory_order_relaxed))
+            return false;
+        if (method > 1) {
+            if (max < 0) {
+                min = max;
+                break;
+            }
+            if (min > 0) break;
+        }
+        int med = Policy::Narrowing::median(min, max);
+        if (debug)
+            std::cout << "Probe [" << min << " " << max << "]-> med=" << med << "\n";
+        // Check if the actual score is greater than med
+        int r = _alphabeta<Policy>(med, med + 1, opponent_winning_bits);
+        if (debug) {
+            for (int i=0; i<indent; ++i) std::cout << " ";
+            std::cout << "Result [" << med << ", " << med+1 << "] = " << r << "\n";
+        }
+        if (r <= med) max = r;
+        else min = r;
+        if (progress) (*progress)(min, max);
     }
+    return true;
+}
+
+Position::PolicyEntry const Position::policies_[] = {
+    { "default",          false, &Position::_narrow_policy<DefaultPolicy> },
+    { "threat-count",     false, &Position::_narrow_policy<SearchPolicy<ThreatCountOrdering, BlockForced, HalvingNarrowing>> },
+    { "center",           false, &Position::_narrow_policy<SearchPolicy<CenterOrdering, BlockForced, HalvingNarrowing>> },
+    { "zero",             false, &Position::_narrow_policy<SearchPolicy<ThreatOrdering, BlockForced, ZeroNarrowing>> },
+    { "bisect",           false, &Position::_narrow_policy<SearchPolicy<ThreatOrdering, BlockForced, BisectNarrowing>> },
+    { "default-wdl",      true,  &Position::_narrow_policy<SearchPolicy<ThreatOrdering, BlockForced, HalvingNarrowing, WDLTransposition>> },
+    { "threat-count-wdl", true,  &Position::_narrow_policy<SearchPolicy<ThreatCountOrdering, BlockForced, HalvingNarrowing, WDLTransposition>> },
+    { "center-wdl",       true,  &Position::_narrow_policy<SearchPolicy<CenterOrdering, BlockForced, HalvingNarrowing, WDLTransposition>> },
+    { "zero-wdl",         true,  &Position::_narrow_policy<SearchPolicy<ThreatOrdering, BlockForced, ZeroNarrowing, WDLTransposition>> },
+    { "bisect-wdl",       true,  &Position::_narrow_policy<SearchPolicy<ThreatOrdering, BlockForced, BisectNarrowing, WDLTransposition>> },
+};
+Position::Narrow Position::narrow_ = Position::policies_[0].narrow;
+std::string Position::policy_{Position::policies_[0].name};
+
+std::vector<std::string> Position::policies() {
+    std::vector<std::string> names;
+    for (auto const& entry: policies_) names.emplace_back(entry.name);
+    return names;
+}
+
+void Position::policy(std::string const& name) {
+    for (auto const& entry: policies_)
+        if (name == entry.name) {
+            if (entry.wdl != wdl_) {
+                if (transpositions_.shared())
+                    throw_logic("The win/draw/loss table can't be shared");
+                // The other kind of table gets the same memory
+                size_t size = transpositions_bytes() / sizeof(Transposition::value_type);
+                wdl_ = entry.wdl;
+                init(size);
+            }
+            narrow_ = entry.narrow;
+            policy_ = name;
+            return;
+        }
+    throw_logic("Unknown search policy '" + name + "'");
+}
+
+int Position::solve(int method, int target_score, int debug) const {
+    int score;
+    if (_trivial(score, debug)) return score;
 
-    // Game doesn't finish in 1 ply, therefore:
     int min, max;
     if (target_score == INT_MIN) {
-        min = -score2();	// win after 2 more plies
-        max =  score3();	// win after 3 more plies
-        if (method == 1) {
-            if (min < -1) min = -1;
-            if (max >  1) max =  1;
-        }
+        _window(method, min, max);
     } else {
         min = target_score;
         max = target_score+1;
     }
 
+    try {
+        _narrow(min, max, method, debug);
+    } catch (Interrupted& interrupted) {
+        // Every completed probe is still valid
+        interrupted.min  = min;
+        interrupted.max  = max;
+        interrupted.best = _best_known_move();
+        throw;
+    }
+    score = min;
+    if (debug) std::cout << "Solve: " << score << "\n";
+
+    return score;
+}
+
+int Position::solve(int method, int min, int max, Progress const& progress) const {
     int score;
-    int indent = INDENT * this->indent();
-    auto opponent_winning_bits = this->opponent_winning_bits();
-    if (false) {
-        // Next move doesn't finish the game. Go full alpha/beta
-        score = _alphabeta(min, max, opponent_winning_bits);
-    } else {
-        // iteratively narrow the min-max exploration window
-        while (min < max) {
-            if (method > 1) {
-                if (max < 0) {
-                    min = max;
-                    break;
+    if (_trivial(score)) return score;
+
+    int low, high;
+    _window(method, low, high);
+    if (min < low)  min = low;
+    if (max > high) max = high;
+    if (min > max) throw_logic("Empty solve window");
+    try {
+        _narrow(min, max, method, 0, nullptr, &progress);
+    } catch (Interrupted& interrupted) {
+        interrupted.min  = min;
+        interrupted.max  = max;
+        interrupted.best = _best_known_move();
+        throw;
+    }
+    return min;
+}
+
+std::vector<int> Position::analyze(int method, uint nr_threads,
+                                   std::vector<char>* exact) const {
+    std::vector<int> scores(WIDTH, INT_MIN);
+    if (exact) exact->assign(WIDTH, true);
+    if (won()) return scores;
+
+    // Columns to do, most promising (center) first
+    std::array<int, WIDTH> columns;
+    int nr_columns = 0;
+    for (auto& move: move_order_) {
+        int x = first_bit(move) / USED_HEIGHT;
+        if (playable(x)) columns[nr_columns++] = x;
+    }
+    if (nr_threads == 0) nr_threads = NR_CPU;
+    if (nr_threads > static_cast<uint>(nr_columns)) nr_threads = nr_columns;
+
+    // Lowest exact child score found so far. A child that scores at least
+    // this much can't be a better move for us
+    std::atomic<int> floor{INT_MAX};
+    std::atomic<int> next{0};
+    std::array<uint64_t, 3> counts{0, 0, 0};
+#if STATISTICS
+    Statistics::Table statistics{};
+#endif /* STATISTICS */
+    std::mutex counts_mutex;
+
+    std::exception_ptr interrupted;
+
+    auto worker = [&](bool helper) {
+        int i;
+        while ((i = next.fetch_add(1, std::memory_order_relaxed)) < nr_columns) try {
+            int x = columns[i];
+            auto child = play(x);
+            child.set_depth();
+            int score;
+            if (!child._trivial(score)) {
+                int min, max;
+                child._window(method, min, max);
+                // No need to look above the floor, a child that scores at
+                // least that much can't be the best move
+                int f = exact ? floor.load(std::memory_order_relaxed) : INT_MAX;
+                if (max > f) max = f;
+                if (min >= max ||
+                    !child._narrow(min, max, method, 0, exact ? &floor : nullptr) ||
+                    min >= f) {
+                    // Child is at least min, so this move is at most -min
+                    scores[x] = -min;
+                    (*exact)[x] = false;
+                    continue;
                 }
-                if (min > 0) break;
-            }
-            int med = min + (max - min)/2;
-            if (debug)
-                std::cout << "Uncooked [" << min << " " << max << "]-> med=" << med << "\n";
-            if (true) {
-                if (     med <= 0 && min/2 < med) med = min/2;
-                else if (med >= 0 && max/2 > med) med = max/2;
-            } else {
-                if (     med <= 0 && min/2 < 0) med = min/2;
-                else if (med >= 0 && max/2 > 0) med = max/2;
-                if (med+1 > max) med = max-1;
-                if (med < min) med = min;
+                score = min;
             }
-            // Check if the actual score is greater than med
-            int r = _alphabeta(med, med + 1, opponent_winning_bits);
-            if (debug) {
-                for (int i=0; i<indent; ++i) std::cout << " ";
-                std::cout << "Result [" << med << ", " << med+1 << "] = " << r << "\n";
-            }
-            if (r <= med) max = r;
-            else min = r;
+            scores[x] = -score;
+            int f = floor.load(std::memory_order_relaxed);
+            while (score < f &&
+                   !floor.compare_exchange_weak(f, score, std::memory_order_relaxed));
+        } catch (Interrupted&) {
+            // Don't start any more columns
+            next.store(nr_columns, std::memory_order_relaxed);
+            std::lock_guard<std::mutex> lock{counts_mutex};
+            interrupted = std::current_exception();
         }
-        score = min;
-    }
-    if (debug) std::cout << "Solve: " << score << "\n";
+        if (!helper) return;
+        std::lock_guard<std::mutex> lock{counts_mutex};
+        counts[0] += nr_visits();
+        counts[1] += hits();
+        counts[2] += misses();
+#if STATISTICS
+        Statistics::add(statistics, Statistics::table());
+#endif /* STATISTICS */
+    };
 
-    return score;
+    std::vector<std::thread> threads;
+    for (uint t=1; t<nr_threads; ++t) threads.emplace_back(worker, true);
+    worker(false);
+    for (auto& thread: threads) thread.join();
+    add_counts(counts[0], counts[1], counts[2]);
+#if STATISTICS
+    Statistics::add(statistics);
+#endif /* STATISTICS */
+    if (interrupted) std::rethrow_exception(interrupted);
+    return scores;
 }
 
 void Position::generate_book(std::string how, int depth, int method) const {
@@ -632,3 +1075,111 @@ void Position::generate_book(std::string how, int depth, int method) const {
     int score = solve(method);
     std::cout << *this << how << " " << score << std::endl;
 }
+
+void Position::book_tasks(std::string how, int depth, BookTasks& tasks) const {
+    if (depth > 0) {
+        --depth;
+        for (int x=0; x<WIDTH; ++x)
+            if (playable(x)) {
+                char ch = '1' + x;
+                play(x).book_tasks(how + ch, depth, tasks);
+            }
+    }
+    tasks.emplace_back(*this, how);
+}
+
+// Same output as generate_book but the positions are solved by a pool
+// of threads sharing the transposition table
+void Position::generate_book(std::string how, int depth, int method,
+                             uint nr_threads, std::ostream& out) const {
+    BookTasks tasks;
+    book_tasks(how, depth, tasks);
+    std::vector<int> scores(tasks.size());
+    std::vector<bool> done(tasks.size(), false);
+    std::mutex mutex;
+    std::condition_variable solved;
+    // Set when a task throws, its position will never be done
+    bool failed = false;
+    TaskPool pool{tasks.size(), nr_threads, [&](size_t i, uint) {
+        int score;
+        try {
+            score = tasks[i].first.solve(method);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock{mutex};
+            failed = true;
+            solved.notify_all();
+            throw;
+        }
+        std::lock_guard<std::mutex> lock{mutex};
+        scores[i] = score;
+        done[i] = true;
+        solved.notify_all();
+    }};
+    // Print in the same order as the single threaded version
+    for (size_t i=0; i<tasks.size(); ++i) {
+        std::unique_lock<std::mutex> lock{mutex};
+        solved.wait(lock, [&]{ return done[i] || failed; });
+        if (!done[i]) break;
+        out << tasks[i].first << tasks[i].second << " " << scores[i] << std::endl;
+    }
+    // Rethrows what stopped the tasks
+    pool.join();
+}
+
+// Walk the position DAG instead of the move tree. Positions are
+// identified by key (or canonical key) and recorded in the order in
+// which the first path reaching them finishes, so children always come
+// before their parents. Only positions at the full depth get searched,
+// the others are scored by negamax over their children
+void Position::generate_unique_book(std::string how, int depth, int method,
+                                    uint nr_threads, bool mirror) const {
+    struct Node {
+        Position pos;
+        std::string how;
+        int depth;
+        int score;
+    };
+    std::vector<Node> nodes;
+    std::unordered_map<Bitmap, uint32_t> index;
+    std::unordered_set<Bitmap> seen;
+    auto id = [mirror](Position const& pos) {
+        return mirror ? pos.canonical_key() : pos.key();
+    };
+
+    std::function<void(Position const&, std::string const&, int)> walk =
+        [&](Position const& pos, std::string const& how, int depth) {
+        if (!seen.insert(id(pos)).second) return;
+        // A won position ends the game
+        if (depth > 0 && !pos.won())
+            for (int x=0; x<WIDTH; ++x)
+                if (pos.playable(x))
+                    walk(pos.play(x), how + static_cast<char>('1' + x), depth-1);
+        index.emplace(id(pos), nodes.size());
+        nodes.emplace_back(Node{pos, how, depth, 0});
+    };
+    walk(*this, how, depth);
+
+    std::vector<uint32_t> leaves;
+    for (uint32_t i=0; i<nodes.size(); ++i)
+        if (nodes[i].depth == 0 || nodes[i].pos.won()) leaves.emplace_back(i);
+    TaskPool{leaves.size(), nr_threads, [&](size_t i, uint) {
+        auto& node = nodes[leaves[i]];
+        node.score = node.pos.solve(method);
+    }}.join();
+
+    for (auto& node: nodes) {
+        if (node.depth == 0 || node.pos.won()) continue;
+        int score = INT_MIN;
+        for (int x=0; x<WIDTH; ++x)
+            if (node.pos.playable(x)) {
+                int s = -nodes[index.at(id(node.pos.play(x)))].score;
+                if (s > score) score = s;
+            }
+        // Full board
+        if (score == INT_MIN) score = 0;
+        node.score = score;
+    }
+    for (auto& node: nodes)
+        std::cout << node.pos << node.how << " " << node.score << "\n";
+    std::cout.flush();
+}
@@ -1,6 +1,15 @@
+#ifndef position_hpp
+# define position_hpp 1
+
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <iostream>
+#include <stdexcept>
 #include <thread>
+#include <utility>
 #include <vector>
 
 #include <cstring>
@@ -102,20 +111,28 @@ class Transposition {
         friend Transposition;
       public:
         value_type() {}
+        // Entries are read and written as single 64-bit words so threads
+        // sharing the table never see a torn entry
         ALWAYS_INLINE
         void set(Bitmap key, int value, int best) {
-        value_ =
-            key |
-            static_cast<Bitmap>(best) << KEY_BITS |
-            static_cast<Bitmap>(value + (MAX_SCORE+1)) << (KEY_BITS+BEST_BITS);
+            Bitmap value_new =
+                key |
+                static_cast<Bitmap>(best) << KEY_BITS |
+                static_cast<Bitmap>(value + (MAX_SCORE+1)) << (KEY_BITS+BEST_BITS);
+            __atomic_store_n(&value_, value_new, __ATOMIC_RELAXED);
         }
         ALWAYS_INLINE
         bool get(Bitmap key, int& score, int& best) const {
-            if ((value_ & KEY_MASK) != key) return false;
-            score = static_cast<int>(value_ >> (KEY_BITS+BEST_BITS)) - (MAX_SCORE+1);
-            best = (value_ >> KEY_BITS) & BEST_MASK;
+            Bitmap value = __atomic_load_n(&value_, __ATOMIC_RELAXED);
+            if ((value & KEY_MASK) != key) return false;
+            score = static_cast<int>(value >> (KEY_BITS+BEST_BITS)) - (MAX_SCORE+1);
+            best = (value >> KEY_BITS) & BEST_MASK;
             return true;
         }
+        // Holds some position (cleared slots are 0)
+        bool used() const {
+            return __atomic_load_n(&value_, __ATOMIC_RELAXED) != 0;
+        }
         static value_type INVALID() { return value_type{static_cast<Bitmap>(-1)}; }
 
       private:
@@ -123,7 +140,29 @@ class Transposition {
         Bitmap value_;
     };
     Transposition(size_t size=0);
+    ~Transposition() { unmap(); }
+    Transposition(Transposition const&) = delete;
+    Transposition& operator=(Transposition const&) = delete;
+    // Private memory for size entries (rounded up to a power of 2)
     void resize(size_t size);
+    // Resize to size entries (a power of 2) keeping the entries. Nothing
+    // is lost when growing, when shrinking entries that collide are
+    // dropped. Works in place, so peak memory is the larger of the sizes
+    void rehash(size_t size);
+    // Use the POSIX shared memory segment name. The first process creates
+    // it with size entries, later ones attach and take the size it has.
+    // The segment is only accessible to its owner and outlives the process
+    // (remove it from /dev/shm)
+    void share(std::string const& name, size_t size);
+    // Keep the table in file. With keep an existing file is used as is
+    // (and its size), otherwise it starts empty with size entries.
+    // Returns if an existing table was kept
+    bool map_file(std::string const& file, size_t size, bool keep);
+    // Write entries begin .. end of a shared or file table to its backing
+    // store. With wait only return when that is done
+    void flush(size_t begin, size_t end, bool wait);
+    // Table memory is shared with other processes or a file
+    bool shared() const { return shared_; }
     void clear() HOT;
     value_type* entry(Bitmap key) {
         return &entries_[fast_hash(key)];
@@ -131,10 +170,26 @@ class Transposition {
     value_type const* entry(Bitmap key) const {
         return &entries_[fast_hash(key)];
     }
-    size_t size()  const { return entries_.size();  }
+    static void prefetch(value_type const* entry) { __builtin_prefetch(entry); }
+    size_t size()  const { return size_;  }
     size_t bytes() const { return size() * sizeof(value_type); }
 
   private:
+    // Start of a shared or file table, the entries follow at HEADER_BYTES.
+    // Describes the build that made the table, so another one won't trust it
+    struct Header {
+        char     magic[8];
+        uint32_t width, height;
+        uint32_t entry_bytes, key_bits;
+        uint64_t size;
+        // Set by the creator once the entries can be used
+        uint64_t ready;
+    };
+    static size_t const HEADER_BYTES = 4096;
+    static char const MAGIC[8];
+    // How long to wait for the creator of a shared table
+    static int const SHARE_TIMEOUT = 10;
+
     ALWAYS_INLINE
     Bitmap fast_hash(Bitmap key) const {
         static_assert(sizeof(key) == sizeof(LCM_MULTIPLIER),
@@ -144,10 +199,128 @@ class Transposition {
     }
     static uint64_t const LCM_MULTIPLIER = UINT64_C(6364136223846793005);
 
+    // Returns false if fd has no complete header (yet)
+    static bool read_header(int fd, Header& header, std::string const& what);
+    void map(size_t size, int fd);
+    void attach(int fd, bool created, size_t size, std::string const& what);
+    void unmap();
+
+    int bits_;
+    Header* header_ = nullptr;
+    value_type* entries_ = nullptr;
+    size_t size_ = 0;
+    bool shared_ = false;
+};
+
+// Table for the weak method which only needs to know if a score is at
+// most -1 (loss), at most 0 (no win) or neither. Keys go through a
+// bijective 49 bit hash whose top bits select the slot, so only the
+// remaining bits need to be stored to identify a key exactly. With 2
+// result bits that fits in 32 bits as long as there are at least
+// 2**MIN_BITS slots, so this holds twice as many positions per byte
+class WDLTransposition {
+  public:
+    static int const RESULT_BITS = 2;
+    static int const MIN_BITS = KEY_BITS - (32 - RESULT_BITS);	// 19
+
+    struct value_type {
+        friend WDLTransposition;
+      public:
+        value_type() {}
+        // Scores above 0 are not worth storing, the weak method never
+        // searches a window above 1
+        ALWAYS_INLINE
+        void set(Bitmap hash, int bits, int value) {
+            if (value > 0) return;
+            uint32_t value_new =
+                static_cast<uint32_t>(hash & ((ONE << (KEY_BITS-bits))-1)) << RESULT_BITS |
+                (value < 0 ? LOSS : NO_WIN);
+            __atomic_store_n(&value_, value_new, __ATOMIC_RELAXED);
+        }
+        ALWAYS_INLINE
+        bool get(Bitmap hash, int bits, int& score) const {
+            uint32_t value = __atomic_load_n(&value_, __ATOMIC_RELAXED);
+            uint32_t result = value & RESULT_MASK;
+            if (result == EMPTY) return false;
+            if ((value >> RESULT_BITS) != (hash & ((ONE << (KEY_BITS-bits))-1)))
+                return false;
+            score = result == LOSS ? -1 : 0;
+            return true;
+        }
+        bool used() const {
+            return (__atomic_load_n(&value_, __ATOMIC_RELAXED) & RESULT_MASK) != EMPTY;
+        }
+
+      private:
+        static uint32_t const EMPTY  = 0;
+        static uint32_t const LOSS   = 1;
+        static uint32_t const NO_WIN = 2;
+        static uint32_t const RESULT_MASK = (1 << RESULT_BITS) - 1;
+        uint32_t value_;
+    };
+    // Ties a slot to the hash of the key it is used for
+    class Entry {
+      public:
+        Entry(value_type* slot, Bitmap hash, int bits):
+            slot_{slot}, hash_{hash}, bits_{bits} {}
+        ALWAYS_INLINE
+        void set(Bitmap, int value, int) { slot_->set(hash_, bits_, value); }
+        ALWAYS_INLINE
+        bool get(Bitmap, int& score, int& best) const {
+            best = 0;
+            return slot_->get(hash_, bits_, score);
+        }
+        bool used() const { return slot_->used(); }
+        Entry* operator->() { return this; }
+        value_type* slot() const { return slot_; }
+      private:
+        value_type* slot_;
+        Bitmap hash_;
+        int bits_;
+    };
+
+    WDLTransposition(size_t size=0);
+    void resize(size_t size);
+    // Resize to size slots keeping the entries (see Transposition::rehash)
+    void rehash(size_t size);
+    void clear() HOT;
+    ALWAYS_INLINE
+    Entry entry(Bitmap key) {
+        Bitmap hash = bijective_hash(key);
+        return Entry{&entries_[hash >> (KEY_BITS-bits_)], hash, bits_};
+    }
+    static void prefetch(Entry const& entry) { __builtin_prefetch(entry.slot()); }
+    size_t size()  const { return entries_.size();  }
+    size_t bytes() const { return size() * sizeof(value_type); }
+
+  private:
+    // Multiplying by an odd number and xor with a right shift are both
+    // invertible modulo 2**KEY_BITS
+    ALWAYS_INLINE
+    static Bitmap bijective_hash(Bitmap key) {
+        key = key * MULTIPLIER1 & KEY_MASK;
+        key ^= key >> (KEY_BITS/2);
+        return key * MULTIPLIER2 & KEY_MASK;
+    }
+    static uint64_t const MULTIPLIER1 = UINT64_C(6364136223846793005);
+    static uint64_t const MULTIPLIER2 = UINT64_C(0x9e3779b97f4a7c15);
+
     int bits_;
     std::vector<value_type> entries_;
 };
 
+class Endgame;
+
+// Thrown when a search runs out of time or visits (or is interrupted).
+// solve() fills in the proven score interval and the best move it knows
+class Interrupted: public std::runtime_error {
+  public:
+    Interrupted(): std::runtime_error{"Search interrupted"} {}
+    int min  = INT_MIN;
+    int max  = INT_MAX;
+    int best = -1;
+};
+
 class Position {
   public:
     typedef enum {
@@ -223,6 +396,40 @@ class Position {
         // after the
         return color_ + mask_;
     }
+    // Inverse of key(). Throws on keys that can't come from a game
+    static Position from_key(Bitmap key);
+    // Inverse of key() without any checks (garbage in, garbage out).
+    // Adding 1 to each column gives 2**height + color, so the top bit of
+    // each column gives the mask
+    ALWAYS_INLINE
+    static Position decode_key(Bitmap key) {
+        Bitmap x = key + BOTTOM_BITS;
+        // Smear the top bit of each column down (without crossing columns)
+        Bitmap smear = x;
+        smear |= smear >> 1 & BOARD_MASK;
+        smear |= smear >> 2 & REPEATING_ROWS((ONE << (HEIGHT-1))-1);
+        smear |= smear >> 4 & REPEATING_ROWS((ONE << (HEIGHT-3))-1);
+        Bitmap top  = smear ^ (smear >> 1 & BOARD_MASK);
+        Bitmap mask = top - BOTTOM_BITS;
+        return Position{key - mask, mask};
+    }
+    // Bulk versions of key() and decode_key() (written to vectorize)
+    static void encode(Position const* RESTRICT positions, Bitmap* RESTRICT keys, size_t n);
+    static void decode(Bitmap const* RESTRICT keys, Position* RESTRICT positions, size_t n);
+    // Could this position come up in a game: the stone counts match and
+    // the player to move has not already won
+    bool valid() const;
+    // Position with the columns in reverse order
+    Position mirror() const;
+    // The one of the position and its mirror image with the lowest key
+    Position canonical() const {
+        Position m = mirror();
+        return m.key() < key() ? m : *this;
+    }
+    // Same key for a position and its mirror image
+    Bitmap canonical_key() const {
+        return std::min(key(), mirror().key());
+    }
     bool operator==(Position const& rhs) const {
         return key() == rhs.key();
     }
@@ -239,7 +446,29 @@ class Position {
 
     int negamax() const;
     int solve(int method=0, int target_score = INT_MIN, int debug=0) const;
+    // Called with the proven [min, max] window after every probe
+    typedef std::function<void(int min, int max)> Progress;
+    // Continue a solve whose score is already known to be in [min, max]
+    int solve(int method, int min, int max, Progress const& progress) const;
+    // Score of every column from the point of view of the player to move.
+    // Unplayable columns get INT_MIN. Moves are solved in parallel on
+    // nr_threads threads (0 means one per CPU) sharing the transposition
+    // table. If exact is given the best score found so far is used as a
+    // bound for the remaining moves (their searches stop there) and
+    // (*exact)[x] tells if the score of
+    // column x is exact or only an upper bound (char, not a bit packed
+    // bool, since the columns are written by different threads)
+    std::vector<int> analyze(int method=0, uint nr_threads=0,
+                             std::vector<char>* exact = nullptr) const;
     void generate_book(std::string how, int depth, int method=0) const;
+    void generate_book(std::string how, int depth, int method,
+                       uint nr_threads, std::ostream& out = std::cout) const;
+    // Positions of a book in generate_book order (children first)
+    typedef std::vector<std::pair<Position, std::string>> BookTasks;
+    void book_tasks(std::string how, int depth, BookTasks& tasks) const;
+    // Book with one record per distinct position (or mirror pair)
+    void generate_unique_book(std::string how, int depth, int method,
+                              uint nr_threads, bool mirror) const;
 
     friend std::ostream& operator<<(std::ostream& os, Position const& pos) {
         char buffer[BOARD_BUFSIZE+1];
@@ -253,13 +482,29 @@ class Position {
     }
     explicit operator bool() const { return mask_ != FULL_MAP; }
 
-    static void init(size_t size) { transpositions_.resize(size); }
+    // The table the search policy uses. For the -wdl policies the same
+    // memory goes to a WDLTransposition table, which only supports the weak
+    // methods
+    static void init(size_t size);
+    // Put the (full) table in POSIX shared memory segment name
+    static void init_shared(std::string const& name, size_t size);
+    // Keep the (full) table in file (see Transposition::map_file)
+    static bool init_file(std::string const& file, size_t size, bool keep);
+    static void flush_transpositions(size_t begin, size_t end, bool wait) {
+        transpositions_.flush(begin, end, wait);
+    }
+    // Change the table to the memory of size full entries without
+    // forgetting what it knows. Not while searching
+    static void resize(size_t size);
     static void reset(bool keep_transpositions = false) {
         start_depth_ = 0;
         nr_visits_ = 0;
         hits_      = 0;
         misses_    = 0;
-        if (!keep_transpositions) transpositions_.clear();
+        // Other processes depend on a shared table
+        if (keep_transpositions || transpositions_.shared()) return;
+        if (wdl_) wdl_transpositions_.clear();
+        else transpositions_.clear();
     };
     void set_depth() const {
         start_depth_ = nr_plies();
@@ -268,32 +513,101 @@ class Position {
         return nr_plies() - start_depth_;
     }
     ALWAYS_INLINE
-    static void visit() { ++nr_visits_; };
+    // The visit budget is exact, the other limits are polled
+    static void visit() {
+        if (UNLIKELY(++nr_visits_ >= visit_budget_ ||
+                     (nr_visits_ & CHECK_MASK) == 0)) check_limits();
+    };
     ALWAYS_INLINE
     static void hit() { ++hits_; };
     ALWAYS_INLINE
     static void miss() { ++misses_; };
+    // Counters are per thread. Worker threads hand theirs back with this
+    static void add_counts(uint64_t nr_visits, uint64_t hits, uint64_t misses) {
+        nr_visits_ += nr_visits;
+        hits_      += hits;
+        misses_    += misses;
+    }
+
+    // Searches throw Interrupted once past the deadline, after
+    // visit_budget visits (per thread) or after interrupt() is called
+    typedef std::chrono::steady_clock Clock;
+    static void deadline(Clock::time_point deadline) {
+        deadline_.store(deadline.time_since_epoch().count(), std::memory_order_relaxed);
+    }
+    static void visit_budget(uint64_t budget) { visit_budget_ = budget; }
+    static void interrupt(bool on = true) {
+        interrupt_.store(on, std::memory_order_relaxed);
+    }
+    static void no_limits() {
+        deadline(Clock::time_point::max());
+        visit_budget(UINT64_MAX);
+        interrupt(false);
+    }
+
+    // Searches return the exact score from the endgame database for
+    // positions with at most endgame->plies() empty cells (nullptr disables)
+    static void endgame(Endgame const* endgame);
 
     static uint64_t nr_visits() { return nr_visits_; };
     static uint64_t hits()      { return hits_; }
     static uint64_t misses()    { return misses_; }
-    static size_t transpositions_size()  { return transpositions_.size();  }
-    static size_t transpositions_bytes() { return transpositions_.bytes(); }
+    static bool wdl() { return wdl_; }
+    // Names of the search policy sets (see policy.hpp), the default first
+    static std::vector<std::string> policies();
+    // Search with the named policy set from now on. Switching to a policy
+    // with the other kind of table replaces the table. Not while searching
+    static void policy(std::string const& name);
+    static std::string const& policy() { return policy_; }
+    static bool transpositions_shared() { return transpositions_.shared(); }
+    static size_t transpositions_size()  {
+        return wdl_ ? wdl_transpositions_.size()  : transpositions_.size();
+    }
+    static size_t transpositions_bytes() {
+        return wdl_ ? wdl_transpositions_.bytes() : transpositions_.bytes();
+    }
     ALWAYS_INLINE
     Transposition::value_type* transposition_entry() const {
         return transpositions_.entry(key());
     }
+    // Upper bound on the score from the table in use
+    bool transposition_get(int& score) const;
+    // Store an upper bound on the score in the table in use
+    void transposition_set(int score) const;
     std::vector<int> principal_variation(int score, int method=0) const;
+    // A column to play without searching: one the table proves reaches
+    // score (as returned by solve), else the most promising one according
+    // to the table, else the first playable one. -1 if there are no moves
+    int best_move(int score, int method=0) const;
 
   private:
-    static int start_depth_;
-    static uint64_t nr_visits_;
+    // Check the deadline and interrupt every 2**16 visits
+    static uint64_t const CHECK_MASK = (UINT64_C(1) << 16) - 1;
+    static void check_limits() NOINLINE COLD;
+    static std::atomic<Clock::rep> deadline_;
+    static std::atomic<bool> interrupt_;
+    static uint64_t visit_budget_;
+    static Endgame const* endgame_;
+    static int endgame_plies_;
+
+    static thread_local int start_depth_;
+    static thread_local uint64_t nr_visits_;
     static Transposition transpositions_;
-    static uint64_t hits_;
-    static uint64_t misses_;
+    static WDLTransposition wdl_transpositions_;
+    static bool wdl_;
+    static thread_local uint64_t hits_;
+    static thread_local uint64_t misses_;
     static std::array<Bitmap, WIDTH> const move_order_;
     static std::array<Bitmap, WIDTH> generate_move_order();
 
+    friend class Microbenchmark;
+    friend class LaneSolver;
+    struct MoveEntry {
+        Bitmap after_move;
+        Bitmap winning_bits;
+        int nr_threats;
+    };
+
     Position(Bitmap color, Bitmap mask): color_{color}, mask_{mask} {}
     static bool _won(Bitmap mask);
     static Bitmap    top_bit(int y) { return    TOP_BIT << y * USED_HEIGHT; }
@@ -303,6 +617,49 @@ class Position {
     }
 
     Bitmap _winning_bits(Bitmap color) const;
+    // The same for any type with Bitmap operators (the lane solver runs
+    // it on vectors of Bitmaps)
+    template <class Bitmaps>
+    static Bitmaps _winning_bits(Bitmaps color, Bitmaps mask);
+    static Bitmap _indifferent_bits(Bitmap color);
+    // Where the opponent may still play without us being able to win
+    // on top of it
+    template <class Bitmaps>
+    static Bitmaps _allowed_bits(Bitmaps opponent_win);
+    // Append the moves in possible to order[pos..] with index[] sorted
+    // on Ordering::rank (see policy.hpp). Returns the new end
+    template <class Ordering>
+    int _order_moves(Bitmap possible, Bitmap opponent_win,
+                     MoveEntry* order, int* index, int pos) const;
+    bool _trivial(int& score, int debug=0) const;
+    void _window(int method, int& min, int& max) const;
+    bool _proven(int target, int method) const;
+    int _best_known_move() const;
+    // Narrow [min, max] with the search policy in use
+    bool _narrow(int& min, int& max, int method, int debug=0,
+                 std::atomic<int> const* floor = nullptr,
+                 Progress const* progress = nullptr) const {
+        return (this->*narrow_)(min, max, method, debug, floor, progress);
+    }
+    template <class Policy>
+    bool _narrow_policy(int& min, int& max, int method, int debug,
+                        std::atomic<int> const* floor,
+                        Progress const* progress) const;
+    typedef bool (Position::*Narrow)(int& min, int& max, int method, int debug,
+                                     std::atomic<int> const* floor,
+                                     Progress const* progress) const;
+    struct PolicyEntry {
+        char const* name;
+        // Uses WDLTransposition
+        bool wdl;
+        Narrow narrow;
+    };
+    static PolicyEntry const policies_[];
+    static Narrow narrow_;
+    static std::string policy_;
+    template <class Table>
+    static Table& _transpositions();
+    template <class Policy>
     int _alphabeta(int alpha, int beta, Bitmap opponent_win) const;
     Position _play(Bitmap move_bit) const {
         Bitmap mask  = mask_  | move_bit;
@@ -316,6 +673,174 @@ class Position {
     Bitmap mask_;
 };
 
+inline bool Position::_won(Bitmap pos) {
+    // horizontal
+    Bitmap m = pos & (pos >> USED_HEIGHT);
+    if (m & (m >> 2*USED_HEIGHT)) return true;
+
+    // diagonal 1
+    m = pos & (pos >> (USED_HEIGHT-1));
+    if (m & (m >> 2*(USED_HEIGHT-1))) return true;
+
+    // diagonal 2
+    m = pos & (pos >> (USED_HEIGHT+1));
+    if (m & (m >> 2*(USED_HEIGHT+1))) return true;
+
+    // vertical;
+    m = pos & (pos >> 1);
+    if (m & (m >> 2)) return true;
+
+    return false;
+}
+
+ALWAYS_INLINE
+Bitmap Position::_indifferent_bits(Bitmap color) {
+    Bitmap r = 0;
+    Bitmap p;
+
+    // vertical
+    p = (color << 1) & (color << 2);
+    // p = 2 stones next to each other (shifted one row up)
+    // Check  Xxx?
+    r |= p & (color << 3);
+    // Check xx?X
+    r |= p & (color >> 1);
+    // p = 2 stones next to each other (shifted one row down)
+    // We can get this from the previous p. Left for now for symmetry
+    //    .xx. => x...
+    p = (color >> 1) & (color >> 2);
+    // Check X?xx
+    r |= p & (color << 1);
+    // Check ?xxX
+    r |= p & (color >> 3);
+
+    // horizontal
+    // p = 2 stones next to each other (shifted one column to the right)
+    //    .xx. => ...x
+    p = (color << USED_HEIGHT) & (color << 2*USED_HEIGHT);
+    // Check  Xxx?
+    r |= p & (color << 3*USED_HEIGHT);
+    // Check xx?X
+    r |= p & (color >> USED_HEIGHT);
+    // p = 2 stones next to each other (shifted one column to the left)
+    // Cannot get this from previous p unless we know top was not shifted out
+    //    .xx. => x...
+    p = (color >> USED_HEIGHT) & (color >> 2*USED_HEIGHT);
+    // Check X?xx
+    r |= p & (color << USED_HEIGHT);
+    // Check ?xxX
+    r |= p & (color >> 3*USED_HEIGHT);
+
+    // diagonals are simular but moving columns one up/down
+    //diagonal 1
+    p = (color << HEIGHT) & (color << 2*HEIGHT);
+    r |= p & (color << 3*HEIGHT);
+    r |= p & (color >> HEIGHT);
+    p = (color >> HEIGHT) & (color >> 2*HEIGHT);
+    r |= p & (color << HEIGHT);
+    r |= p & (color >> 3*HEIGHT);
+
+    //diagonal 2
+    p = (color << (USED_HEIGHT+1)) & (color << 2*(USED_HEIGHT+1));
+    r |= p & (color << 3*(USED_HEIGHT+1));
+    r |= p & (color >> (USED_HEIGHT+1));
+    p = (color >> (USED_HEIGHT+1)) & (color >> 2*(USED_HEIGHT+1));
+    r |= p & (color << (USED_HEIGHT+1));
+    r |= p & (color >> 3*(USED_HEIGHT+1));
+
+    // All of them can mistakenly hit the guard bit(s) and already filled bits
+    // We mask these out here
+    // BOARD_MASK ^ mask = bits that are actually empty
+    return r & BOARD_MASK;
+}
+
+ALWAYS_INLINE
+Bitmap Position::_winning_bits(Bitmap color) const {
+    return _winning_bits(color, mask_);
+}
+
+template <class Bitmaps>
+ALWAYS_INLINE
+Bitmaps Position::_winning_bits(Bitmaps color, Bitmaps mask) {
+    // vertical (3 stones on top of each other)
+    Bitmaps r = (color << 1) & (color << 2) & (color << 3);
+
+    Bitmaps p;
+    // horizontal
+    // p = 2 stones next to each other (shifted one column to the right)
+    //    .xx. => ...x
+    p = (color << USED_HEIGHT) & (color << 2*USED_HEIGHT);
+    // Check  Xxx?
+    r |= p & (color << 3*USED_HEIGHT);
+    // Check xx?X
+    r |= p & (color >> USED_HEIGHT);
+    // p = 2 stones next to each other (shifted one column to the left)
+    //    .xx. => x...
+    p = (color >> USED_HEIGHT) & (color >> 2*USED_HEIGHT);
+    // Check X?xx
+    r |= p & (color << USED_HEIGHT);
+    // Check ?xxX
+    r |= p & (color >> 3*USED_HEIGHT);
+
+    // diagonals are simular but moving columns one up/down
+    // diagonal 1
+    p = (color << HEIGHT) & (color << 2*HEIGHT);
+    r |= p & (color << 3*HEIGHT);
+    r |= p & (color >> HEIGHT);
+    p = (color >> HEIGHT) & (color >> 2*HEIGHT);
+    r |= p & (color << HEIGHT);
+    r |= p & (color >> 3*HEIGHT);
+
+    // diagonal 2
+    p = (color << (USED_HEIGHT+1)) & (color << 2*(USED_HEIGHT+1));
+    r |= p & (color << 3*(USED_HEIGHT+1));
+    r |= p & (color >> (USED_HEIGHT+1));
+    p = (color >> (USED_HEIGHT+1)) & (color >> 2*(USED_HEIGHT+1));
+    r |= p & (color << (USED_HEIGHT+1));
+    r |= p & (color >> 3*(USED_HEIGHT+1));
+
+    // All of them can mistakenly hit the guard bit(s) and already filled bits
+    // We mask these out here
+    // BOARD_MASK ^ mask = bits that are actually empty
+    return r & (BOARD_MASK ^ mask);
+}
+
+template <class Bitmaps>
+ALWAYS_INLINE
+Bitmaps Position::_allowed_bits(Bitmaps opponent_win) {
+    auto opponent_stacked = opponent_win & (opponent_win << 1);
+    // Convert to mask
+    auto opponent_allowed = opponent_stacked | ABOVE_BITS;
+    opponent_allowed &= ~opponent_allowed + BOTTOM_BITS;
+    opponent_allowed -= BOTTOM_BITS;
+    return opponent_allowed & BOARD_MASK;
+}
+
+template <class Ordering>
+ALWAYS_INLINE
+int Position::_order_moves(Bitmap possible, Bitmap opponent_win,
+                           MoveEntry* order, int* index, int pos) const {
+    Bitmap my_stones = color_ ^ mask_;
+    Bitmap opponent_allowed = _allowed_bits(opponent_win);
+    // Insertion sort based on the rank of each move
+    for (int i=0; i<WIDTH; ++i) {
+        Bitmap move_bit = possible & move_order_[i];
+        if (!move_bit) continue;
+        // We can actually move there
+        Bitmap after_move = my_stones | move_bit;
+        Bitmap winning_bits = _winning_bits(after_move);
+        int nr_threats = Ordering::rank(winning_bits & opponent_allowed);
+        order[pos] = MoveEntry{after_move, winning_bits, nr_threats};
+        int p = pos;
+        while (nr_threats > order[index[p-1]].nr_threats) {
+            index[p] = index[p-1];
+            --p;
+        }
+        index[p] = pos++;
+    }
+    return pos;
+}
+
 template <>
 struct std::hash<Position> {
     size_t operator()(Position const& pos) const {
@@ -324,3 +849,5 @@ struct std::hash<Position> {
   private:
     static uint64_t const LCM_MULTIPLIER = UINT64_C(6364136223846793005);
 };
+
+#endif /* position_hpp */
@@ -0,0 +1,124 @@
+#include <cstdio>
+
+#include "statistics.hpp"
+
+#if STATISTICS
+
+char const* const Statistics::NAMES[NR_COUNTERS] = {
+    "visits", "hits", "misses", "collisions",
+    "double_threats", "forced", "fail_high", "fail_low",
+};
+
+char const* const Statistics::FEATURE_NAMES[NR_FEATURES] = {
+    "center", "threats", "stacked", "table",
+};
+
+thread_local Statistics::Table Statistics::table_;
+
+void Statistics::add(Table& to, Table const& from) {
+    for (size_t ply=0; ply<to.plies.size(); ++ply)
+        for (int c=0; c<NR_COUNTERS; ++c)
+            to.plies[ply][c] += from.plies[ply][c];
+    for (size_t i=0; i<to.cutoffs.size(); ++i)
+        for (int f=0; f<NR_FEATURES; ++f)
+            to.cutoffs[i][f] += from.cutoffs[i][f];
+    for (int f=0; f<NR_FEATURES; ++f)
+        to.firsts[f] += from.firsts[f];
+}
+
+void Statistics::add(Table const& table) {
+    add(table_, table);
+}
+
+void Statistics::print(std::ostream& os) {
+    char buffer[200];
+    os << "ply";
+    for (int c=0; c<NR_COUNTERS; ++c) {
+        snprintf(buffer, sizeof(buffer), " %14s", NAMES[c]);
+        os << buffer;
+    }
+    os << "  hit rate\n";
+    for (size_t ply=0; ply<table_.plies.size(); ++ply) {
+        auto const& counts = table_.plies[ply];
+        if (!counts[VISITS]) continue;
+        snprintf(buffer, sizeof(buffer), "%3zu", ply);
+        os << buffer;
+        for (int c=0; c<NR_COUNTERS; ++c) {
+            snprintf(buffer, sizeof(buffer), " %14llu",
+                     static_cast<unsigned long long>(counts[c]));
+            os << buffer;
+        }
+        uint64_t probes = counts[HITS] + counts[MISSES];
+        snprintf(buffer, sizeof(buffer), "  %7.1f%%",
+                 probes ? 100. * counts[HITS] / probes : 0.);
+        os << buffer << "\n";
+    }
+
+    // Move ordering
+    uint64_t nr_cutoffs = 0;
+    double index_sum = 0;
+    std::array<uint64_t, NR_FEATURES> by_feature{}, first_by_feature{};
+    for (size_t i=1; i<table_.cutoffs.size(); ++i)
+        for (int f=0; f<NR_FEATURES; ++f) {
+            auto n = table_.cutoffs[i][f];
+            nr_cutoffs  += n;
+            index_sum   += 1. * n * i;
+            by_feature[f] += n;
+            if (i == 1) first_by_feature[f] += n;
+        }
+    if (!nr_cutoffs) return;
+    uint64_t first = 0;
+    for (auto n: first_by_feature) first += n;
+    snprintf(buffer, sizeof(buffer), "cutoffs: %llu, by first move: %.1f%%, average move: %.3f\n",
+             static_cast<unsigned long long>(nr_cutoffs),
+             100. * first / nr_cutoffs, index_sum / nr_cutoffs);
+    os << buffer;
+    os << "cutoffs at move:";
+    for (size_t i=1; i<table_.cutoffs.size(); ++i) {
+        uint64_t n = 0;
+        for (auto c: table_.cutoffs[i]) n += c;
+        snprintf(buffer, sizeof(buffer), " %.1f%%", 100. * n / nr_cutoffs);
+        os << buffer;
+    }
+    os << "\n";
+    // How often a first move ranked by a feature was good enough
+    for (int f=0; f<NR_FEATURES; ++f) {
+        auto tried = table_.firsts[f];
+        snprintf(buffer, sizeof(buffer), "%-8s first %14llu, cutoff %5.1f%%, cutoffs %5.1f%%\n",
+                 FEATURE_NAMES[f], static_cast<unsigned long long>(tried),
+                 tried ? 100. * first_by_feature[f] / tried : 0.,
+                 100. * by_feature[f] / nr_cutoffs);
+        os << buffer;
+    }
+}
+
+void Statistics::print_json(std::ostream& os) {
+    os << "{\"plies\": [";
+    bool first = true;
+    for (size_t ply=0; ply<table_.plies.size(); ++ply) {
+        auto const& counts = table_.plies[ply];
+        if (!counts[VISITS]) continue;
+        os << (first ? "" : ", ") << "{\"ply\": " << ply;
+        first = false;
+        for (int c=0; c<NR_COUNTERS; ++c)
+            os << ", \"" << NAMES[c] << "\": " << counts[c];
+        os << "}";
+    }
+    // cutoffs[move][feature], move counted from 1
+    os << "], \"features\": [";
+    for (int f=0; f<NR_FEATURES; ++f)
+        os << (f ? ", " : "") << "\"" << FEATURE_NAMES[f] << "\"";
+    os << "], \"cutoffs\": [";
+    for (size_t i=1; i<table_.cutoffs.size(); ++i) {
+        os << (i > 1 ? ", " : "") << "[";
+        for (int f=0; f<NR_FEATURES; ++f)
+            os << (f ? ", " : "") << table_.cutoffs[i][f];
+        os << "]";
+    }
+    os << "], \"firsts\": [";
+    for (int f=0; f<NR_FEATURES; ++f)
+        os << (f ? ", " : "") << table_.firsts[f];
+    os << "]}\n";
+}
+
+#endif /* STATISTICS */
@@ -0,0 +1,93 @@
+#ifndef statistics_hpp
+# define statistics_hpp 1
+
+#include <array>
+#include <iostream>
+
+#include "position.hpp"
+
+// Build with -D STATISTICS=1 to count per ply where the search spends its
+// nodes. Without it all counting compiles away
+#ifndef STATISTICS
+# define STATISTICS 0
+#endif /* STATISTICS */
+
+class Statistics {
+  public:
+    enum Counter {
+        VISITS,
+        HITS,
+        MISSES,
+        // Misses where the slot holds another position
+        COLLISIONS,
+        // Returned early because the opponent has two winning moves
+        DOUBLE_THREATS,
+        // Only one move was possible since it blocks a win
+        FORCED,
+        // Some move or the lower bound reached beta
+        FAIL_HIGH,
+        // Neither a move nor the upper bound got above alpha
+        FAIL_LOW,
+        NR_COUNTERS,
+    };
+    static char const* const NAMES[NR_COUNTERS];
+    // What put a move where it is in the move order of _alphabeta (the
+    // Ordering of the policy decides, see policy.hpp)
+    enum Feature {
+        // No threats, so only the center first order
+        CENTER,
+        // Number of threats it creates
+        THREATS,
+        // Also the bonus for two threats on top of each other
+        STACKED,
+        // Best move stored in the transposition table
+        TABLE,
+        NR_FEATURES,
+    };
+    static char const* const FEATURE_NAMES[NR_FEATURES];
+    struct Table {
+        // Indexed by the number of stones on the board
+        std::array<std::array<uint64_t, NR_COUNTERS>, AREA+1> plies;
+        // Indexed by the place (from 1) of the move that caused a cutoff
+        std::array<std::array<uint64_t, NR_FEATURES>, WIDTH+1> cutoffs;
+        // Feature of the first move tried
+        std::array<uint64_t, NR_FEATURES> firsts;
+    };
+
+#if STATISTICS
+    ALWAYS_INLINE
+    static void count(Counter counter, int ply) {
+        ++table_.plies[ply][counter];
+    }
+    ALWAYS_INLINE
+    static void first(Feature feature) {
+        ++table_.firsts[feature];
+    }
+    ALWAYS_INLINE
+    static void cutoff(int index, Feature feature) {
+        ++table_.cutoffs[index][feature];
+    }
+    // Counters are per thread (like Position::nr_visits()) and are not
+    // cleared by Position::reset()
+    static Table const& table() { return table_; }
+    static void reset() { table_ = Table{}; }
+    // Add counts from (typically) a worker thread
+    static void add(Table const& table);
+    static void add(Table& to, Table const& from);
+    // Plies without any visits are left out
+    static void print(std::ostream& os);
+    static void print_json(std::ostream& os);
+
+  private:
+    static thread_local Table table_;
+#else /* STATISTICS */
+    // No table at all, so callers must put anything beyond these under
+    // #if STATISTICS
+    static void count(Counter, int) {}
+    static void first(Feature) {}
+    static void cutoff(int, Feature) {}
+    static void reset() {}
+#endif /* STATISTICS */
+};
+
+#endif /* statistics_hpp */
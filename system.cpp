@@ -1,10 +1,13 @@
 #include "system.hpp"
 
+#include <algorithm>
 #include <atomic>
 #include <map>
 #include <system_error>
 
+#include <cstdint>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <ctime>
 
@@ -18,6 +21,7 @@ std::string CPUS;
 
 size_t SYSTEM_MEMORY;
 size_t SYSTEM_SWAP;
+size_t CGROUP_MEMORY;
 uint NR_CPU;
 
 bool FATAL = false;
@@ -100,6 +104,72 @@ void get_cpu_string() {
         CPUS.append(std::to_string(NR_CPU));
 }
 
+// Smallest limit in file name in cgroup directory root+path and its
+// ancestors. Missing files and "max" (no limit) are ignored
+static size_t cgroup_limit(std::string const& root, std::string path,
+                    char const* name) {
+    size_t limit = SIZE_MAX;
+    while (true) {
+        FILE* fp = fopen((root + path + "/" + name).c_str(), "r");
+        if (fp) {
+            char buffer[64];
+            if (fgets(buffer, sizeof(buffer), fp)) {
+                char* end;
+                unsigned long long value = strtoull(buffer, &end, 10);
+                // cgroup v1 writes "no limit" as a huge number
+                if (end != buffer && value < limit &&
+                    value < static_cast<unsigned long long>(1) << 62)
+                    limit = value;
+            }
+            fclose(fp);
+        }
+        auto slash = path.rfind('/');
+        if (slash == std::string::npos) break;
+        path.resize(slash);
+    }
+    return limit;
+}
+
+// Linux specific
+static size_t cgroup_memory() {
+    FILE* fp = fopen("/proc/self/cgroup", "r");
+    if (!fp) return SIZE_MAX;
+    char *line = NULL;
+    size_t len = 0;
+    ssize_t nread;
+    size_t limit = SIZE_MAX;
+    while ((nread = getline(&line, &len, fp)) != -1) {
+        // hierarchy-ID:controller-list:cgroup-path
+        std::string entry{line, static_cast<size_t>(nread)};
+        if (!entry.empty() && entry.back() == '\n') entry.pop_back();
+        auto colon1 = entry.find(':');
+        if (colon1 == std::string::npos) continue;
+        auto colon2 = entry.find(':', colon1+1);
+        if (colon2 == std::string::npos) continue;
+        std::string controllers = entry.substr(colon1+1, colon2-colon1-1);
+        std::string path = entry.substr(colon2+1);
+        if (path == "/") path.clear();
+        if (controllers.empty()) {
+            // cgroup v2, mounted on its own or next to v1
+            limit = std::min(limit, cgroup_limit("/sys/fs/cgroup", path, "memory.max"));
+            limit = std::min(limit, cgroup_limit("/sys/fs/cgroup/unified", path, "memory.max"));
+        } else if (("," + controllers + ",").find(",memory,") != std::string::npos)
+            limit = std::min(limit, cgroup_limit("/sys/fs/cgroup/memory", path, "memory.limit_in_bytes"));
+    }
+    free(line);
+    fclose(fp);
+    return limit;
+}
+
+size_t memory_limit() {
+    struct sysinfo s_info;
+    if (sysinfo(&s_info))
+        throw_errno("Could not determine memory");
+    CGROUP_MEMORY = cgroup_memory();
+    return std::min(static_cast<size_t>(s_info.totalram) * s_info.mem_unit,
+                    CGROUP_MEMORY);
+}
+
 inline std::string _time_string(time_t time) {
     struct tm tm;
 
@@ -147,6 +217,6 @@ void init_system() {
     struct sysinfo s_info;
     if (sysinfo(&s_info))
         throw_errno("Could not determine memory");
-    SYSTEM_MEMORY = static_cast<size_t>(s_info.totalram ) * s_info.mem_unit;
+    SYSTEM_MEMORY = memory_limit();
     SYSTEM_SWAP   = static_cast<size_t>(s_info.totalswap) * s_info.mem_unit;
 }
@@ -1,3 +1,6 @@
+#ifndef system_hpp
+# define system_hpp 1
+
 #include <iostream>
 #include <string>
 
@@ -8,6 +11,8 @@
 extern uint NR_CPU;
 extern size_t SYSTEM_MEMORY;
 extern size_t SYSTEM_SWAP;
+// Memory limit of our cgroup (SIZE_MAX if none). SYSTEM_MEMORY includes it
+extern size_t CGROUP_MEMORY;
 extern const std::string PID;
 extern std::string HOSTNAME;
 extern std::string CPUS;
@@ -28,3 +33,8 @@ std::string time_string(time_t time);
 std::string time_string();
 
 void init_system() COLD;
+// Current physical memory or cgroup limit, whichever is lower
+// (the cgroup limit can change while we run)
+size_t memory_limit();
+
+#endif /* system_hpp */
@@ -0,0 +1,204 @@
+#include <algorithm>
+#include <fstream>
+#include <unordered_map>
+#include <vector>
+
+#include "pool.hpp"
+#include "validate.hpp"
+
+namespace {
+
+struct BookEntry {
+    std::string how;
+    Position pos;
+    int score;
+    // First entry for the same position (moves can transpose)
+    size_t same;
+    // Not in the book but a sibling is
+    bool added;
+    bool solved;
+    int solution;
+    std::vector<size_t> children;
+
+    ~BookEntry();
+    int value() const { return solved ? solution : score; }
+};
+
+BookEntry::~BookEntry() {}
+
+int sign(int value) { return (value > 0) - (value < 0); }
+
+// Same rules as the book reader in connect4
+void read_book(std::string const& book, std::vector<BookEntry>& entries) {
+    std::ifstream file;
+    file.exceptions(std::ifstream::badbit);
+    file.open(book);
+    if (!file) throw_errno("Could not open '" + book + "'");
+    std::string line;
+    int64_t line_nr = 0;
+    while (getline(file, line)) {
+        ++line_nr;
+        if (line.empty()) continue;
+        if (!(line[0] == ' ' || ('0' <= line[0] && line[0] <= '9'))) continue;
+        auto space = line.find(' ');
+        if (space == std::string::npos)
+            throw_logic("No score on line " + std::to_string(line_nr));
+        Position pos;
+        pos.clear();
+        pos = pos.play(line.data(), space);
+        std::string how = line.substr(0, space);
+        line.erase(0, space+1);
+        int score = std::stoi(line, &space);
+        if (space == 0)
+            throw_logic("No score on line " + std::to_string(line_nr));
+        if (score > pos.score())
+            throw_logic("Impossible high score on line " + std::to_string(line_nr));
+        if (score < -pos.score1())
+            throw_logic("Impossible low score on line " + std::to_string(line_nr));
+        entries.emplace_back(BookEntry{how, pos, score, entries.size(), false, false, 0, {}});
+    }
+}
+
+}
+
+size_t validate_book(std::string const& book, int method, uint nr_threads,
+                     std::ostream& out) {
+    std::vector<BookEntry> entries;
+    read_book(book, entries);
+    size_t nr_book = entries.size();
+
+    auto agree = [method](int a, int b) {
+        return method ? sign(a) == sign(b) : a == b;
+    };
+
+    std::vector<size_t> to_solve;
+    std::vector<bool> queued;
+    std::vector<bool> suspect(nr_book, false);
+    std::unordered_map<Position, size_t> index;
+    for (size_t i=0; i<nr_book; ++i) {
+        auto found = index.emplace(entries[i].pos, i);
+        if (found.second) continue;
+        size_t same = found.first->second;
+        entries[i].same = same;
+        // Transpositions must have the same score
+        if (!agree(entries[i].score, entries[same].score))
+            suspect[same] = true;
+    }
+
+    // Link children, adding the missing ones of inner positions. A missing
+    // child with children of its own in the book gets its score from them,
+    // all others are solved. Won and full positions are trivial to solve
+    for (size_t i=0; i<entries.size(); ++i) {
+        if (entries[i].same != i) continue;
+        auto const pos = entries[i].pos;
+        if (pos.won() || !pos.possible_bits()) {
+            to_solve.emplace_back(i);
+            continue;
+        }
+        std::vector<std::pair<int, Position>> missing;
+        for (int x=0; x<WIDTH; ++x) {
+            if (!pos.playable(x)) continue;
+            auto child = pos.play(x);
+            auto found = index.find(child);
+            if (found != index.end()) entries[i].children.emplace_back(found->second);
+            else missing.emplace_back(x, child);
+        }
+        // A leaf. Only the range check applies
+        if (entries[i].children.empty()) {
+            if (entries[i].added || suspect[i]) to_solve.emplace_back(i);
+            continue;
+        }
+        for (auto const& m: missing) {
+            std::string how = entries[i].how + static_cast<char>('1' + m.first);
+            size_t c = entries.size();
+            entries.emplace_back(BookEntry{how, m.second, 0, c, true, false, 0, {}});
+            suspect.emplace_back(false);
+            index.emplace(m.second, c);
+            entries[i].children.emplace_back(c);
+        }
+    }
+
+    // Inner positions, deepest first so children are settled before their
+    // parents are looked at
+    std::vector<size_t> inner;
+    for (size_t i=0; i<entries.size(); ++i)
+        if (entries[i].same == i && !entries[i].children.empty())
+            inner.emplace_back(i);
+    std::stable_sort(inner.begin(), inner.end(), [&](size_t l, size_t r) {
+        return entries[l].pos.nr_plies() > entries[r].pos.nr_plies();
+    });
+
+    // An inconsistent inner position is never solved itself (the shallow
+    // ones are far too expensive). Either it or one of its children is
+    // wrong, so first solve the leaves below it. Once all of those are
+    // known and it still disagrees it is wrong and takes the score its
+    // children give, which can make its parent inconsistent in turn
+    size_t nr_solved = 0;
+    while (true) {
+        if (!to_solve.empty()) {
+            TaskPool pool{to_solve.size(), nr_threads, [&](size_t task, uint) {
+                auto& entry = entries[to_solve[task]];
+                entry.solution = entry.pos.solve(method);
+            }};
+            pool.join();
+            for (auto i: to_solve) entries[i].solved = true;
+            nr_solved += to_solve.size();
+            to_solve.clear();
+        }
+        queued.assign(entries.size(), false);
+        for (auto i: inner) {
+            auto& entry = entries[i];
+            int best = INT_MIN;
+            for (auto c: entry.children)
+                best = std::max(best, -entries[c].value());
+            if (entry.added) {
+                // Nothing to check, the children are all there is
+                entry.solved   = true;
+                entry.solution = best;
+                continue;
+            }
+            // A transposition disagreed, so even a consistent score is
+            // only settled by looking at the leaves
+            if (!suspect[i] && agree(best, entry.value())) continue;
+            bool pending = false;
+            for (auto c: entry.children)
+                if (entries[c].children.empty() && !entries[c].solved) {
+                    pending = true;
+                    if (!queued[c]) {
+                        queued[c] = true;
+                        to_solve.emplace_back(c);
+                    }
+                }
+            if (pending) continue;
+            suspect[i]     = false;
+            entry.solved   = true;
+            entry.solution = best;
+        }
+        if (to_solve.empty()) break;
+    }
+
+    // The corrected score of every book line
+    std::vector<int> scores(nr_book);
+    size_t nr_wrong = 0;
+    for (size_t i=0; i<nr_book; ++i) {
+        auto const& entry = entries[i];
+        auto const& same  = entries[entry.same];
+        scores[i] = entry.score;
+        if (!same.solved || agree(same.solution, entry.score)) continue;
+        scores[i] = same.solution;
+        ++nr_wrong;
+        std::cerr << "Book entry '" << entry.how << "' has score " << entry.score << " but should be " << same.solution << std::endl;
+    }
+    std::cerr << "Book " << book << ": " << nr_book << " entries, " << nr_wrong << " wrong, " << entries.size() - nr_book << " missing, " << nr_solved << " solved" << std::endl;
+
+    // The corrected book, added children just before their parent
+    for (size_t i=0; i<nr_book; ++i) {
+        auto const& entry = entries[i];
+        for (auto c: entry.children)
+            if (entries[c].added)
+                out << entries[c].pos << entries[c].how << " " << entries[c].solution << "\n";
+        out << entry.pos << entry.how << " " << scores[i] << "\n";
+    }
+    out.flush();
+    return nr_wrong;
+}
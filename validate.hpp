@@ -0,0 +1,22 @@
+#ifndef validate_hpp
+# define validate_hpp 1
+
+#include <string>
+
+#include "position.hpp"
+
+// Check every entry of an opening book (as written by generate_book)
+// against the entries of its children: the score of a position is the
+// best of minus the scores after each move. Below an inconsistent entry
+// the leaves are solved again (by nr_threads threads), after which inner
+// entries that still disagree take the score of their children, which
+// can make parents inconsistent in turn. Inner entries are never solved
+// themselves. Children missing from a position that has some in the book
+// are added. Leaves below consistent entries are only range checked. With
+// method > 0 (a weak book) scores only need to agree in sign. Mismatches
+// are reported on std::cerr and the corrected book is written to out.
+// Returns the number of entries that were wrong
+size_t validate_book(std::string const& book, int method, uint nr_threads,
+                     std::ostream& out = std::cout);
+
+#endif /* validate_hpp */